@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -25,9 +25,18 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 SOURCES += main.cpp\
         mainwindow.cpp \
-    scene.cpp
+    scene.cpp \
+    canvas.cpp \
+    batchrenderer.cpp \
+    mask.cpp \
+    journal.cpp
 
 HEADERS  += mainwindow.h \
-    scene.h
+    scene.h \
+    canvas.h \
+    batchrenderer.h \
+    mask.h \
+    journal.h \
+    pixelformat.h
 
 FORMS    += mainwindow.ui
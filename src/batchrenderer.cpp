@@ -0,0 +1,488 @@
+#include "batchrenderer.h"
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QAtomicInt>
+#include <QThread>
+#include <QtConcurrent>
+
+BatchRenderer::BatchRenderer(const QString &outputDir, PixelFormat format) : outputDir(outputDir), format(format)
+{
+	parsers.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+int BatchRenderer::main(const QStringList &arguments)
+{
+	// arguments[0] is the program, arguments[1] is "--batch"
+	QString outputDir = ".";
+	PixelFormat format = ARGB32;
+	QStringList inputs;
+	for (int i = 2; i < arguments.size(); ++i)
+	{
+		if (arguments[i] == "-o" && i + 1 < arguments.size())
+		{
+			outputDir = arguments[++i];
+		}
+		else if (arguments[i] == "-f" && i + 1 < arguments.size())
+		{
+			QString name = arguments[++i];
+			if (name == "argb32")
+				format = ARGB32;
+			else if (name == "rgb565")
+				format = RGB565;
+			else if (name == "indexed8")
+				format = INDEXED8;
+			else if (name == "mono")
+				format = MONO;
+			else
+			{
+				qWarning() << "unknown format" << name;
+				return 2;
+			}
+		}
+		else
+		{
+			inputs.push_back(arguments[i]);
+		}
+	}
+	if (inputs.isEmpty())
+	{
+		qWarning() << "usage: MiniPainter --batch [-o output_dir] [-f argb32|rgb565|indexed8|mono] documents...";
+		return 2;
+	}
+	// outputs are named after the documents only, so a/x.txt and b/x.txt would overwrite each other
+	QHash<QString, QString> outputs;
+	for (const QString &input : inputs)
+	{
+		QString name = QFileInfo(input).completeBaseName();
+		if (outputs.contains(name))
+		{
+			qWarning() << input << "and" << outputs[name] << "would both be saved as" << name + ".png";
+			return 2;
+		}
+		outputs.insert(name, input);
+	}
+	if (!QDir().mkpath(outputDir))
+	{
+		qWarning() << "can not create output directory" << outputDir;
+		return 2;
+	}
+
+	BatchRenderer renderer(outputDir, format);
+	return renderer.run(inputs) ? 1 : 0;
+}
+
+int BatchRenderer::run(const QStringList &inputs)
+{
+	QStringList documents = inputs;
+	QAtomicInt failed = 0;
+	QtConcurrent::blockingMap(documents, [this, &failed](const QString &input) {
+		if (!render(input))
+			failed.fetchAndAddRelaxed(1);
+	});
+	return failed.load();
+}
+
+bool BatchRenderer::render(const QString &input)
+{
+	switch (format)
+	{
+	case RGB565:
+		return render<Rgb565>(input);
+	case INDEXED8:
+		return render<Indexed8>(input);
+	case MONO:
+		return render<Mono1>(input);
+	default:
+		return render<Argb32>(input);
+	}
+}
+
+template <class Format>
+bool BatchRenderer::render(const QString &input)
+{
+	// parse in another thread while rasterizing here
+	CommandQueue queue;
+	QFuture<void> parser = QtConcurrent::run(&parsers, [this, &input, &queue]() { parse(input, queue); });
+
+	BasicCanvas<Format> canvas;
+	State state;
+	bool ok = true;
+	bool end = false;
+	while (!end)
+	{
+		QVector<Command> batch = queue.pop();
+		for (const Command &command : batch)
+		{
+			if (command.verb == END)
+			{
+				end = true;
+				break;
+			}
+			if (command.verb == INVALID)
+			{
+				qWarning().noquote() << QString("%1:%2: %3").arg(input).arg(command.line).arg(command.error);
+				ok = false;
+			}
+			if (ok) // keep draining after an error, so the parser can finish
+				execute(canvas, state, command);
+		}
+	}
+	parser.waitForFinished();
+	if (!ok)
+		return false;
+
+	QString output = QDir(outputDir).filePath(QFileInfo(input).completeBaseName() + ".png");
+	if (!canvas.toImage().save(output))
+	{
+		qWarning() << "can not write" << output;
+		return false;
+	}
+	return true;
+}
+
+void BatchRenderer::parse(const QString &input, CommandQueue &queue) const
+{
+	QFile file(input);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+	{
+		Command command(INVALID);
+		command.error = "can not open document";
+		queue.push(QVector<Command>() << command << Command(END));
+		return;
+	}
+
+	QVector<Command> batch;
+	int number = 0;
+	while (!file.atEnd())
+	{
+		QByteArray line = file.readLine().trimmed();
+		++number;
+		if (line.isEmpty() || line.startsWith('#'))
+			continue;
+		batch.push_back(parseLine(line, number));
+		if (batch.size() == BATCH_SIZE)
+		{
+			queue.push(batch);
+			batch.clear();
+		}
+	}
+	batch.push_back(Command(END, number));
+	queue.push(batch);
+}
+
+BatchRenderer::Command BatchRenderer::parseLine(const QByteArray &line, int number)
+{
+	QList<QByteArray> words = line.simplified().split(' ');
+	QByteArray verb = words[0];
+	Command command(INVALID, number);
+
+	if (verb == "fill-mode")
+	{
+		command.verb = FILL_MODE;
+		if (words.size() == 2 && (words[1] == "none" || words[1] == "no"))
+			command.args << NO << 0;
+		else if (words.size() == 2 && words[1] == "color")
+			command.args << COLOR << 0;
+		else if (words.size() == 2 && words[1] == "linear")
+			command.args << LINEAR << 0;
+		else if (words.size() == 2 && words[1] == "radial")
+			command.args << RADIAL << 0;
+		else if ((words.size() == 2 || words.size() == 3) && words[1] == "shadow")
+		{
+			bool ok = true;
+			int interval = words.size() == 3 ? words[2].toInt(&ok) : 1;
+			if (!ok || interval < 0)
+			{
+				command.verb = INVALID;
+				command.error = "bad shadow interval";
+			}
+			command.args << SHADOW << interval;
+		}
+		else
+		{
+			command.verb = INVALID;
+			command.error = "fill-mode expects none, color, linear, radial or shadow [interval]";
+		}
+		return command;
+	}
+
+	if (verb == "fill-rule")
+	{
+		command.verb = FILL_RULE;
+		if (words.size() == 2 && (words[1] == "evenodd" || words[1] == "nonzero"))
+		{
+			command.args << (words[1] == "evenodd" ? Canvas::EVEN_ODD : Canvas::NON_ZERO);
+		}
+		else
+		{
+			command.verb = INVALID;
+			command.error = "fill-rule expects evenodd or nonzero";
+		}
+		return command;
+	}
+
+	if (verb == "antialias")
+	{
+		command.verb = ANTIALIAS;
+		if (words.size() == 2 && (words[1] == "on" || words[1] == "off"))
+		{
+			command.args << (words[1] == "on");
+		}
+		else
+		{
+			command.verb = INVALID;
+			command.error = "antialias expects on or off";
+		}
+		return command;
+	}
+
+	if (verb == "hatch")
+	{
+		command.verb = HATCH;
+		bool ok = words.size() >= 2 && words.size() <= 4;
+		int angle = ok ? words[1].toInt(&ok) : 0;
+		int width = 1;
+		bool cross = false;
+		for (int i = 2; ok && i < words.size(); ++i)
+		{
+			if (words[i] == "cross")
+				cross = true;
+			else if (i == 2)
+				width = words[i].toInt(&ok);
+			else
+				ok = false;
+		}
+		if (!ok || angle < 0 || width < 1)
+		{
+			command.verb = INVALID;
+			command.error = "hatch expects angle [width] [cross]";
+		}
+		command.args << angle << width << cross;
+		return command;
+	}
+
+	if (verb == "flood-mode")
+	{
+		command.verb = FLOOD_MODE;
+		bool ok = words.size() >= 2 && words.size() <= 4;
+		int tolerance = ok ? words[1].toInt(&ok) : 0;
+		Canvas::ToleranceMode mode = Canvas::CHANNEL;
+		bool eightConnected = false;
+		for (int i = 2; ok && i < words.size(); ++i)
+		{
+			if (words[i] == "channel" || words[i] == "distance")
+				mode = words[i] == "channel" ? Canvas::CHANNEL : Canvas::DISTANCE;
+			else if (words[i] == "4" || words[i] == "8")
+				eightConnected = words[i] == "8";
+			else
+				ok = false;
+		}
+		if (!ok || tolerance < 0 || tolerance > 255)
+		{
+			command.verb = INVALID;
+			command.error = "flood-mode expects tolerance (0-255) [channel|distance] [4|8]";
+		}
+		command.args << tolerance << mode << eightConnected;
+		return command;
+	}
+
+	if (verb == "fg" || verb == "bg")
+	{
+		command.verb = verb == "fg" ? FG : BG;
+		if (words.size() == 4)
+		{
+			bool okR, okG, okB;
+			command.color = QColor(words[1].toInt(&okR), words[2].toInt(&okG), words[3].toInt(&okB));
+			if (!okR || !okG || !okB)
+				command.color = QColor();
+		}
+		else if (words.size() == 2)
+		{
+			command.color = QColor(QString(words[1]));
+		}
+		if (!command.color.isValid())
+		{
+			command.verb = INVALID;
+			command.error = "bad color";
+		}
+		return command;
+	}
+
+	// the rest verbs only take coordinates
+	bool sizeOk;
+	if (verb == "line" || verb == "rect" || verb == "ellipse")
+	{
+		command.verb = verb == "line" ? LINE : (verb == "rect" ? RECT : ELLIPSE);
+		sizeOk = words.size() == 5;
+	}
+	else if (verb == "polygon")
+	{
+		command.verb = POLYGON;
+		sizeOk = words.size() >= 7 && words.size() % 2 == 1;
+	}
+	else if (verb == "flood")
+	{
+		command.verb = FLOOD;
+		sizeOk = words.size() == 3;
+	}
+	else
+	{
+		command.error = QString("unknown command %1").arg(QString(verb));
+		return command;
+	}
+	if (!sizeOk)
+	{
+		command.error = QString("wrong number of coordinates for %1").arg(QString(verb));
+		command.verb = INVALID;
+		return command;
+	}
+	for (int i = 1; i < words.size(); ++i)
+	{
+		bool ok;
+		command.args.push_back(words[i].toInt(&ok));
+		if (!ok || qAbs(command.args.last()) > MAX_COORDINATE)
+		{
+			command.error = QString("bad coordinate %1").arg(QString(words[i]));
+			command.verb = INVALID;
+			return command;
+		}
+	}
+	return command;
+}
+
+template <class Format>
+void BatchRenderer::execute(BasicCanvas<Format> &canvas, State &state, const Command &command) const
+{
+	// left top (0, 0) -> left bottom (0, 0)
+	QVector<QPoint> points;
+	if (command.verb != FILL_MODE && command.verb != FILL_RULE && command.verb != ANTIALIAS && command.verb != HATCH && command.verb != FLOOD_MODE)
+	{
+		for (int i = 0; i + 1 < command.args.size(); i += 2)
+			points.push_back(QPoint(command.args[i], canvas.height() - command.args[i + 1] - 1));
+	}
+
+	// replay what Scene does for the same mouse input
+	QVector<Canvas::Temp> temp;
+	QVector<Canvas::Edge> edges;
+	switch (command.verb)
+	{
+	case LINE:
+		getLine(canvas, state, points[0], points[1], temp);
+		canvas.merge(temp);
+		break;
+	case RECT:
+		canvas.getRect(points[0].x(), points[0].y(), points[1].x(), points[1].y(), state.fgColor, temp);
+		edges.push_back(Canvas::Edge(points[0], QPoint(points[0].x(), points[1].y())));
+		edges.push_back(Canvas::Edge(points[0], QPoint(points[1].x(), points[0].y())));
+		edges.push_back(Canvas::Edge(points[1], QPoint(points[0].x(), points[1].y())));
+		edges.push_back(Canvas::Edge(points[1], QPoint(points[1].x(), points[0].y())));
+		finishShape(canvas, state, edges, temp);
+		break;
+	case ELLIPSE:
+		edges = canvas.getEllipse(points[0].x(), points[0].y(), points[1].x(), points[1].y());
+		canvas.getOutline(edges, state.fgColor, state.antialiased, temp);
+		finishShape(canvas, state, edges, temp);
+		break;
+	case POLYGON:
+		for (int i = 0; i < points.size(); ++i)
+		{
+			// the last edge closes the polygon
+			edges.push_back(Canvas::Edge(points[i], points[(i + 1) % points.size()]));
+		}
+		canvas.getOutline(edges, state.fgColor, state.antialiased, temp);
+		finishShape(canvas, state, edges, temp);
+		break;
+	case FLOOD:
+		if (state.fillMode == LINEAR || state.fillMode == RADIAL)
+		{
+			Mask region = canvas.selectRegion(points[0].x(), points[0].y(), state.floodRule);
+			canvas.fillMask(region, fillStyle(state, region.boundingRect()));
+		}
+		else
+		{
+			canvas.floodFill(points[0].x(), points[0].y(), state.fgColor, state.floodRule);
+		}
+		break;
+	case FILL_MODE:
+		state.fillMode = FillMode(command.args[0]);
+		state.interval = command.args[1];
+		break;
+	case FILL_RULE:
+		state.fillRule = Canvas::FillRule(command.args[0]);
+		break;
+	case ANTIALIAS:
+		state.antialiased = command.args[0];
+		break;
+	case HATCH:
+		state.hatchAngle = command.args[0] % 180;
+		state.hatchWidth = command.args[1];
+		state.crossHatch = command.args[2];
+		break;
+	case FLOOD_MODE:
+		state.floodRule = Canvas::FloodRule(command.args[0], Canvas::ToleranceMode(command.args[1]), command.args[2]);
+		break;
+	case FG:
+		state.fgColor = command.color;
+		break;
+	case BG:
+		state.bgColor = command.color;
+		break;
+	default:
+		break;
+	}
+}
+
+void BatchRenderer::getLine(const CanvasBase &canvas, const State &state, QPoint p1, QPoint p2, QVector<Canvas::Temp> &result) const
+{
+	if (state.antialiased)
+		canvas.getSmoothLine(p1.x(), p1.y(), p2.x(), p2.y(), state.fgColor, result);
+	else
+		canvas.getLine(p1.x(), p1.y(), p2.x(), p2.y(), state.fgColor, result);
+}
+
+template <class Format>
+void BatchRenderer::finishShape(BasicCanvas<Format> &canvas, const State &state, const QVector<Canvas::Edge> &edges, const QVector<Canvas::Temp> &outline) const
+{
+	// like Scene::finishShape, the border of a filled shape is drawn by fill, so edge pixels are blended once
+	if (state.fillMode == NO)
+		canvas.merge(outline);
+	else
+		canvas.fill(edges, fillStyle(state, Canvas::boundingRect(edges)), state.fgColor, state.fillRule, state.antialiased);
+}
+
+Canvas::FillStyle BatchRenderer::fillStyle(const State &state, const QRect &bounds) const
+{
+	switch (state.fillMode)
+	{
+	case LINEAR:
+		return Canvas::FillStyle::linear(state.bgColor, state.fgColor, bounds);
+	case RADIAL:
+		return Canvas::FillStyle::radial(state.bgColor, state.fgColor, bounds);
+	case SHADOW:
+		return Canvas::FillStyle::hatch(state.bgColor, state.interval, state.hatchAngle, state.hatchWidth, state.crossHatch);
+	default:
+		return Canvas::FillStyle(state.bgColor);
+	}
+}
+
+void BatchRenderer::CommandQueue::push(const QVector<Command> &batch)
+{
+	QMutexLocker locker(&mutex);
+	while (batches.size() >= CAPACITY)
+		notFull.wait(&mutex);
+	batches.push_back(batch);
+	notEmpty.wakeOne();
+}
+
+QVector<BatchRenderer::Command> BatchRenderer::CommandQueue::pop()
+{
+	QMutexLocker locker(&mutex);
+	while (batches.isEmpty())
+		notEmpty.wait(&mutex);
+	QVector<Command> batch = batches.takeFirst();
+	notFull.wakeOne();
+	return batch;
+}
@@ -0,0 +1,137 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QVector>
+#include <QList>
+#include <QColor>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include "canvas.h"
+
+// Render drawing command streams to image files without a window.
+//
+// Every input file is a document, one command per line, coordinates are
+// canvas pixels with left top as (0, 0) just like mouse positions:
+//   line x1 y1 x2 y2
+//   rect x1 y1 x2 y2
+//   ellipse x1 y1 x2 y2        (bounding rect)
+//   polygon x1 y1 x2 y2 x3 y3 ...
+//   flood x y
+//   fill-mode none|color|linear|radial|shadow [interval]
+//   fill-rule evenodd|nonzero
+//   antialias on|off           (lines and fill edges)
+//   hatch angle [width] [cross] (lines of shadow fill)
+//   flood-mode tolerance [channel|distance] [4|8]
+//   fg r g b | fg name         (name is anything QColor accepts, like #ff0000)
+//   bg r g b | bg name
+// Lines starting with '#' are comments. The image is saved as PNG in the
+// output directory, named after the document (documents with the same name
+// are refused). With -f the canvas keeps its pixels in a smaller format
+// (see pixelformat.h), colors are quantized to it.
+class BatchRenderer
+{
+public:
+	enum PixelFormat // of canvas
+	{
+		ARGB32,
+		RGB565,
+		INDEXED8,
+		MONO
+	};
+
+	BatchRenderer(const QString &outputDir, PixelFormat format = ARGB32);
+
+	int run(const QStringList &inputs);						 // render documents in parallel, return number of failed documents
+	static int main(const QStringList &arguments); // "MiniPainter --batch [-o output_dir] [-f format] documents..."
+
+private:
+	const int BATCH_SIZE = 256; // commands passed from parser to rasterizer at once
+	static const int MAX_COORDINATE = 32767; // lines are walked pixel by pixel, farther points only take time and memory
+
+	enum Verb
+	{
+		LINE,
+		RECT,
+		ELLIPSE,
+		POLYGON,
+		FLOOD,
+		FILL_MODE,
+		FILL_RULE,
+		ANTIALIAS,
+		HATCH,
+		FLOOD_MODE,
+		FG,
+		BG,
+		INVALID, // error is in Command::error
+		END			 // end of document
+	};
+
+	enum FillMode
+	{
+		SHADOW,
+		COLOR,
+		LINEAR,
+		RADIAL,
+		NO
+	};
+
+	struct Command
+	{
+		Verb verb;
+		QVector<int> args; // coordinates, fill mode and shadow interval, fill rule, anti-aliasing, hatch or flood rule
+		QColor color;
+		int line; // line number in the document
+		QString error;
+		Command(Verb verb = END, int line = 0) : verb(verb), line(line) {}
+	};
+
+	struct State // same defaults as MainWindow
+	{
+		QColor fgColor = QColor(0, 0, 0);
+		QColor bgColor = QColor(255, 255, 255);
+		FillMode fillMode = NO;
+		int interval = 1;
+		int hatchAngle = 0;
+		int hatchWidth = 1;
+		bool crossHatch = false;
+		Canvas::FillRule fillRule = Canvas::EVEN_ODD;
+		bool antialiased = false;
+		Canvas::FloodRule floodRule;
+	};
+
+	class CommandQueue // bounded, parser pushes and rasterizer pops
+	{
+	public:
+		void push(const QVector<Command> &batch); // block while full
+		QVector<Command> pop();										// block while empty
+
+	private:
+		const int CAPACITY = 8; // batches
+		QMutex mutex;
+		QWaitCondition notEmpty;
+		QWaitCondition notFull;
+		QList<QVector<Command>> batches;
+	};
+
+	QString outputDir;
+	PixelFormat format;
+	QThreadPool parsers; // documents use the global pool, so a parser never waits for a document thread
+
+	bool render(const QString &input); // in format
+	template <class Format>
+	bool render(const QString &input);
+	void parse(const QString &input, CommandQueue &queue) const;
+	static Command parseLine(const QByteArray &line, int number);
+	template <class Format>
+	void execute(BasicCanvas<Format> &canvas, State &state, const Command &command) const;
+	void getLine(const CanvasBase &canvas, const State &state, QPoint p1, QPoint p2, QVector<Canvas::Temp> &result) const; // aliased or not by state
+	template <class Format>
+	void finishShape(BasicCanvas<Format> &canvas, const State &state, const QVector<Canvas::Edge> &edges, const QVector<Canvas::Temp> &outline) const; // merge outline, or fill edges with their border
+	Canvas::FillStyle fillStyle(const State &state, const QRect &bounds) const; // same as Scene::fillStyle
+};
+
+#endif // BATCHRENDERER_H
@@ -0,0 +1,1483 @@
+#include "canvas.h"
+#include <QDebug>
+#include <QtAlgorithms>
+#include <QtMath>
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// set bit i when pixels[i] is within tolerance of seed, bits should be cleared before
+static void matchPixels(const QRgb *pixels, int count, QRgb seed, const CanvasBase::FloodRule &rule, quint64 *bits)
+{
+	int i = 0;
+#ifdef __SSE2__
+	// 4 pixels at a time
+	__m128i s = _mm_set1_epi32(int(seed));
+	__m128i zero = _mm_setzero_si128();
+	__m128i channelLimit = _mm_set1_epi8(char(qMin(rule.tolerance, 255)));
+	__m128i distanceLimit = _mm_set1_epi32(rule.tolerance * rule.tolerance + 1);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + i));
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(p, s), _mm_subs_epu8(s, p)); // |p - s| of every channel
+		__m128i ok;
+		if (rule.mode == CanvasBase::CHANNEL)
+		{
+			ok = _mm_cmpeq_epi32(_mm_subs_epu8(diff, channelLimit), zero);
+		}
+		else
+		{
+			// squares of 16 bit channels, summed in pairs by madd, then pairs summed per pixel
+			__m128i low = _mm_unpacklo_epi8(diff, zero);
+			__m128i high = _mm_unpackhi_epi8(diff, zero);
+			__m128 squareLow = _mm_castsi128_ps(_mm_madd_epi16(low, low));
+			__m128 squareHigh = _mm_castsi128_ps(_mm_madd_epi16(high, high));
+			__m128i even = _mm_castps_si128(_mm_shuffle_ps(squareLow, squareHigh, _MM_SHUFFLE(2, 0, 2, 0)));
+			__m128i odd = _mm_castps_si128(_mm_shuffle_ps(squareLow, squareHigh, _MM_SHUFFLE(3, 1, 3, 1)));
+			ok = _mm_cmplt_epi32(_mm_add_epi32(even, odd), distanceLimit);
+		}
+		bits[i >> 6] |= quint64(_mm_movemask_ps(_mm_castsi128_ps(ok))) << (i & 63);
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		int dr = qAbs(qRed(pixels[i]) - qRed(seed));
+		int dg = qAbs(qGreen(pixels[i]) - qGreen(seed));
+		int db = qAbs(qBlue(pixels[i]) - qBlue(seed));
+		int da = qAbs(qAlpha(pixels[i]) - qAlpha(seed));
+		bool ok;
+		if (rule.mode == CanvasBase::CHANNEL)
+			ok = qMax(qMax(dr, dg), qMax(db, da)) <= rule.tolerance;
+		else
+			ok = dr * dr + dg * dg + db * db + da * da <= rule.tolerance * rule.tolerance;
+		if (ok)
+			bits[i >> 6] |= 1ULL << (i & 63);
+	}
+}
+
+// colors over under by alphas, alpha of colors is ignored
+static void blendPixels(QRgb *under, const QRgb *colors, const quint8 *alphas, int count)
+{
+	int i = 0;
+#ifdef __SSE2__
+	// 2 pixels in 16 bit channels per half, (c * a + u * (255 - a) + 128) / 255 like CanvasBase::blend
+	__m128i zero = _mm_setzero_si128();
+	__m128i full = _mm_set1_epi16(255);
+	__m128i round = _mm_set1_epi16(128);
+	__m128i opaque = _mm_set1_epi32(int(0xff000000));
+	auto mix = [&](__m128i c, __m128i u, __m128i a) {
+		__m128i x = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(c, a), _mm_mullo_epi16(u, _mm_sub_epi16(full, a))), round);
+		return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+	};
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i c = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(colors + i)), opaque);
+		__m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i *>(under + i));
+		__m128i aLow = _mm_setr_epi16(alphas[i], alphas[i], alphas[i], alphas[i], alphas[i + 1], alphas[i + 1], alphas[i + 1], alphas[i + 1]);
+		__m128i aHigh = _mm_setr_epi16(alphas[i + 2], alphas[i + 2], alphas[i + 2], alphas[i + 2], alphas[i + 3], alphas[i + 3], alphas[i + 3], alphas[i + 3]);
+		__m128i low = mix(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(u, zero), aLow);
+		__m128i high = mix(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(u, zero), aHigh);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(under + i), _mm_packus_epi16(low, high));
+	}
+#endif
+	for (; i < count; ++i)
+		under[i] = CanvasBase::blend((colors[i] & 0xffffff) | (QRgb(alphas[i]) << 24), under[i]);
+}
+
+// deposit the signed area of a line piece inside one row, coverage of pixel x is the sum of acc[0] to acc[x]
+static void accumulate(float *acc, float x, float xNext, float d)
+{
+	float x0 = qMin(x, xNext);
+	float x1 = qMax(x, xNext);
+	float x0Floor = qFloor(x0);
+	int x0i = int(x0Floor);
+	float x1Ceil = qCeil(x1);
+	int x1i = int(x1Ceil);
+	if (x1i <= x0i + 1)
+	{
+		// inside one pixel, split by the middle of the piece
+		float xm = 0.5f * (x + xNext) - x0Floor;
+		acc[x0i] += d - d * xm;
+		acc[x0i + 1] += d * xm;
+		return;
+	}
+
+	// a triangle at both ends, the same area in every pixel between
+	float s = 1 / (x1 - x0);
+	float x0f = x0 - x0Floor;
+	float a0 = 0.5f * s * (1 - x0f) * (1 - x0f);
+	float x1f = x1 - x1Ceil + 1;
+	float am = 0.5f * s * x1f * x1f;
+	acc[x0i] += d * a0;
+	if (x1i == x0i + 2)
+	{
+		acc[x0i + 1] += d * (1 - a0 - am);
+	}
+	else
+	{
+		float a1 = s * (1.5f - x0f);
+		acc[x0i + 1] += d * (a1 - a0);
+		for (int xi = x0i + 2; xi < x1i - 1; ++xi)
+			acc[xi] += d * s;
+		float a2 = a1 + (x1i - x0i - 3) * s;
+		acc[x1i - 1] += d * (1 - a2 - am);
+	}
+	acc[x1i] += d * am;
+}
+
+// prefix sums of acc into 8 bit coverage by the fill rule, acc is cleared for the next row
+static void resolveCoverage(float *acc, quint8 *coverage, int count, bool nonZero)
+{
+	int i = 0;
+	float sum = 0;
+#ifdef __SSE2__
+	// 4 sums at a time, by adding the vector shifted by 1 and 2 lanes
+	__m128 carry = _mm_setzero_ps();
+	__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 one = _mm_set1_ps(1);
+	__m128 two = _mm_set1_ps(2);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 scale = _mm_set1_ps(255);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(acc + i);
+		x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+		x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+		x = _mm_add_ps(x, carry);
+		carry = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+		__m128 w = _mm_and_ps(x, absMask);
+		if (nonZero)
+		{
+			w = _mm_min_ps(w, one);
+		}
+		else
+		{
+			// distance from the nearest even winding, 1 at odd windings
+			__m128 t = _mm_sub_ps(w, _mm_mul_ps(two, _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(w, half)))));
+			w = _mm_sub_ps(one, _mm_and_ps(_mm_sub_ps(one, t), absMask));
+		}
+		__m128i c = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(w, scale), half));
+		c = _mm_packs_epi32(c, c);
+		c = _mm_packus_epi16(c, c);
+		int packed = _mm_cvtsi128_si32(c);
+		memcpy(coverage + i, &packed, 4);
+		_mm_storeu_ps(acc + i, _mm_setzero_ps());
+	}
+	sum = _mm_cvtss_f32(carry);
+#endif
+	for (; i < count; ++i)
+	{
+		sum += acc[i];
+		acc[i] = 0;
+		float w = qAbs(sum);
+		if (nonZero)
+		{
+			w = qMin(w, 1.0f);
+		}
+		else
+		{
+			float t = w - 2 * int(w * 0.5f);
+			w = 1 - qAbs(1 - t);
+		}
+		coverage[i] = quint8(int(w * 255 + 0.5f));
+	}
+}
+
+void CanvasBase::BresenhamLine(int x1, int y1, int x2, int y2, const QColor &color, QVector<Temp> &result) const
+{
+	// check x1, y1, x2, y2
+	if (x1 > x2)
+	{
+		qDebug() << "bad x";
+		return;
+	}
+	if (y1 > y2)
+	{
+		qDebug() << "bad y";
+		return;
+	}
+	if (abs(x1 - x2) < abs(y1 - y2))
+	{
+		qDebug() << "bad scale";
+		return;
+	}
+
+	result.clear();
+	int e = -(x2 - x1);
+	int currentY = y1;
+	for (int i = x1; i <= x2; ++i)
+	{
+		if (e >= 0)
+		{
+			e -= 2 * (x2 - x1);
+			++currentY;
+		}
+		e += 2 * (y2 - y1);
+		result.push_back(Temp(i, currentY, color)); // result[i - x1]
+	}
+}
+
+void CanvasBase::getLine(int x1, int y1, int x2, int y2, const QColor &color, QVector<Temp> &result) const
+{
+	if (x1 <= x2)
+	{
+		if (y1 <= y2)
+		{
+			if (abs(x1 - x2) >= abs(y1 - y2))
+			{
+				// 0 <= gradient <= 1
+				BresenhamLine(x1, y1, x2, y2, color, result);
+			}
+			else
+			{
+				// 1 < gradient < infinite
+				BresenhamLine(y1, x1, y2, x2, color, result);
+				swapTemp(result);
+			}
+		}
+		else
+		{
+			if (abs(x1 - x2) >= abs(y1 - y2))
+			{
+				// -1 <= gradient < 0
+				BresenhamLine(x1, y1, x2, 2 * y1 - y2, color, result);
+				flipY(result, y1);
+			}
+			else
+			{
+				// -infinite < gradient < -1
+				BresenhamLine(y1, x1, 2 * y1 - y2, x2, color, result);
+				swapTemp(result);
+				flipY(result, y1);
+			}
+		}
+	}
+	else
+	{
+		// exchange start and end
+		if (y2 <= y1)
+		{
+			if (abs(x2 - x1) >= abs(y2 - y1))
+			{
+				// 0 <= gradient <= 1
+				BresenhamLine(x2, y2, x1, y1, color, result);
+			}
+			else
+			{
+				// 1 < gradient < infinite
+				BresenhamLine(y2, x2, y1, x1, color, result);
+				swapTemp(result);
+			}
+		}
+		else
+		{
+			if (abs(x2 - x1) >= abs(y2 - y1))
+			{
+				// -1 <= gradient < 0
+				BresenhamLine(x2, y2, x1, 2 * y2 - y1, color, result);
+				flipY(result, y2);
+			}
+			else
+			{
+				// -infinite < gradient < -1
+				BresenhamLine(y2, x2, 2 * y2 - y1, x1, color, result);
+				swapTemp(result);
+				flipY(result, y2);
+			}
+		}
+	}
+}
+
+void CanvasBase::getRect(int x1, int y1, int x2, int y2, const QColor &color, QVector<Temp> &result) const
+{
+	for (int i = min(x1, x2); i <= max(x1, x2); ++i)
+	{
+		result.push_back(Temp(i, y1, color));
+		result.push_back(Temp(i, y2, color));
+	}
+	for (int i = min(y1, y2); i <= max(y1, y2); ++i)
+	{
+		result.push_back(Temp(x1, i, color));
+		result.push_back(Temp(x2, i, color));
+	}
+}
+
+QVector<CanvasBase::Edge> CanvasBase::getEllipse(int x1, int y1, int x2, int y2) const
+{
+	// using Polygon Approximation Method, edges of polygon is 360
+	double a = abs(x1 - x2) / 2.0;
+	double b = abs(y1 - y2) / 2.0;
+	QPoint center = QPoint((x2 + x1) / 2, (y2 + y1) / 2);
+	int n = 360; // edges' number of polygon
+
+	QVector<Edge> edges;
+	if (a == 0 || b == 0)
+	{
+		// a flat box is its straight line, there and back so it encloses nothing
+		edges.push_back(Edge(QPoint(x1, y1), QPoint(x2, y2)));
+		edges.push_back(Edge(QPoint(x2, y2), QPoint(x1, y1)));
+		return edges;
+	}
+	double sin = qSin(qDegreesToRadians(double(360 / n)));
+	double cos = qCos(qDegreesToRadians(double(360 / n)));
+	double currentX = a;
+	double currentY = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		double nextX = currentX * cos - a / b * currentY * sin;
+		double nextY = currentY * cos + b / a * currentX * sin;
+		auto e = Edge(QPoint(currentX + center.x(), currentY + center.y()), QPoint(nextX + center.x(), nextY + center.y()));
+		if (e.p1 != e.p2)
+			edges.push_back(e);
+		currentX = nextX;
+		currentY = nextY;
+	}
+	// too small to leave the center pixel
+	if (edges.isEmpty())
+	{
+		edges.push_back(Edge(center, center));
+		return edges;
+	}
+	// add the last edge
+	edges.push_back(Edge(QPoint(currentX + center.x(), currentY + center.y()), edges[0].p1));
+	return edges;
+}
+
+void CanvasBase::getPolyline(const QVector<QPoint> &vertices, const QColor &color, QVector<Temp> &result) const
+{
+	result.clear();
+	if (vertices.size() == 1)
+	{
+		result.push_back(Temp(vertices[0].x(), vertices[0].y(), color));
+		return;
+	}
+
+	// connect pieces with Bresenham lines, joint pixels are kept once
+	QVector<Temp> line;
+	for (int i = 1; i < vertices.size(); ++i)
+	{
+		getLine(vertices[i - 1].x(), vertices[i - 1].y(), vertices[i].x(), vertices[i].y(), color, line);
+		for (int j = 0; j < line.size(); ++j)
+		{
+			if (i == 1 || line[j].x != vertices[i - 1].x() || line[j].y != vertices[i - 1].y())
+				result.push_back(line[j]);
+		}
+	}
+}
+
+void CanvasBase::getSmoothLine(int x1, int y1, int x2, int y2, const QColor &color, QVector<Temp> &result) const
+{
+	result.clear();
+
+	// step along the major axis, the line is split between the two nearest pixels of the minor axis
+	bool steep = abs(y2 - y1) > abs(x2 - x1);
+	if (steep)
+	{
+		qSwap(x1, y1);
+		qSwap(x2, y2);
+	}
+	if (x1 > x2)
+	{
+		qSwap(x1, x2);
+		qSwap(y1, y2);
+	}
+	int dx = x2 - x1;
+	int dy = y2 - y1;
+	for (int i = 0; i <= dx; ++i)
+	{
+		// exact minor position y1 + i * dy / dx, as whole pixels and 8 bit fraction
+		int t = dx ? i * dy : 0;
+		int whole = t >= 0 ? t / max(dx, 1) : -((-t + dx - 1) / dx);
+		int fraction = dx ? (t - whole * dx) * 255 / dx : 0;
+		int coverage[2] = {255 - fraction, fraction};
+		for (int k = 0; k < 2; ++k)
+		{
+			if (coverage[k] == 0)
+				continue;
+			QColor c = color;
+			c.setAlpha(color.alpha() * coverage[k] / 255);
+			if (steep)
+				result.push_back(Temp(y1 + whole + k, x1 + i, c));
+			else
+				result.push_back(Temp(x1 + i, y1 + whole + k, c));
+		}
+	}
+}
+
+void CanvasBase::getSmoothPolyline(const QVector<QPoint> &vertices, const QColor &color, QVector<Temp> &result) const
+{
+	result.clear();
+	if (vertices.size() == 1)
+	{
+		result.push_back(Temp(vertices[0].x(), vertices[0].y(), color));
+		return;
+	}
+
+	// pixels near joints are covered by both pieces, so they are joined instead of blended twice
+	QVector<Temp> line;
+	for (int i = 1; i < vertices.size(); ++i)
+	{
+		getSmoothLine(vertices[i - 1].x(), vertices[i - 1].y(), vertices[i].x(), vertices[i].y(), color, line);
+		result.append(line);
+	}
+	joinCoverage(result);
+}
+
+void CanvasBase::getOutline(const QVector<Edge> &edges, const QColor &color, bool antialiased, QVector<Temp> &result) const
+{
+	result.clear();
+	QVector<Temp> line;
+	for (const Edge &e : edges)
+	{
+		if (antialiased)
+			getSmoothLine(e.p1.x(), e.p1.y(), e.p2.x(), e.p2.y(), color, line);
+		else
+			getLine(e.p1.x(), e.p1.y(), e.p2.x(), e.p2.y(), color, line);
+		result.append(line);
+	}
+	if (antialiased)
+		joinCoverage(result); // pixels near vertices are covered by two lines, so they are joined instead of blended twice
+}
+
+void CanvasBase::joinCoverage(QVector<Temp> &temp)
+{
+	std::sort(temp.begin(), temp.end(), [](const Temp &a, const Temp &b) { return a.y != b.y ? a.y < b.y : a.x < b.x; });
+	int kept = 0;
+	for (int i = 0; i < temp.size(); ++i)
+	{
+		if (kept && temp[kept - 1].x == temp[i].x && temp[kept - 1].y == temp[i].y)
+		{
+			if (temp[i].color.alpha() > temp[kept - 1].color.alpha())
+				temp[kept - 1] = temp[i];
+			continue;
+		}
+		temp[kept++] = temp[i];
+	}
+	temp.resize(kept);
+}
+
+void CanvasBase::flattenBezier(QPointF p0, QPointF p1, QPointF p2, QPointF p3, QVector<QPoint> &vertices, int depth)
+{
+	// flat if control points lie within half a pixel of the chord and between its end points
+	double dx = p3.x() - p0.x();
+	double dy = p3.y() - p0.y();
+	double chord = dx * dx + dy * dy;
+	bool flat;
+	if (chord < 1e-6)
+	{
+		// degenerated chord, measure control points from p0
+		QPointF d1 = p1 - p0;
+		QPointF d2 = p2 - p0;
+		flat = d1.x() * d1.x() + d1.y() * d1.y() <= 0.25 && d2.x() * d2.x() + d2.y() * d2.y() <= 0.25;
+	}
+	else
+	{
+		double cross1 = qAbs((p1.x() - p0.x()) * dy - (p1.y() - p0.y()) * dx);
+		double cross2 = qAbs((p2.x() - p0.x()) * dy - (p2.y() - p0.y()) * dx);
+		double dot1 = (p1.x() - p0.x()) * dx + (p1.y() - p0.y()) * dy;
+		double dot2 = (p2.x() - p0.x()) * dx + (p2.y() - p0.y()) * dy;
+		flat = (cross1 + cross2) * (cross1 + cross2) <= 0.25 * chord && dot1 >= 0 && dot1 <= chord && dot2 >= 0 && dot2 <= chord;
+	}
+
+	if (flat || depth >= 16)
+	{
+		QPoint end = p3.toPoint();
+		if (vertices.isEmpty() || vertices.last() != end)
+			vertices.push_back(end);
+		return;
+	}
+
+	// split at t = 0.5 using de Casteljau's algorithm
+	QPointF p01 = (p0 + p1) / 2;
+	QPointF p12 = (p1 + p2) / 2;
+	QPointF p23 = (p2 + p3) / 2;
+	QPointF p012 = (p01 + p12) / 2;
+	QPointF p123 = (p12 + p23) / 2;
+	QPointF middle = (p012 + p123) / 2;
+	flattenBezier(p0, p01, p012, middle, vertices, depth + 1);
+	flattenBezier(middle, p123, p23, p3, vertices, depth + 1);
+}
+
+CanvasBase::FillStyle CanvasBase::FillStyle::linear(const QColor &from, const QColor &to, const QRect &bounds)
+{
+	FillStyle style(from);
+	style.type = LINEAR;
+	style.endColor = to;
+	style.start = QPoint(bounds.left(), bounds.center().y());
+	style.end = QPoint(bounds.right(), bounds.center().y());
+	return style;
+}
+
+CanvasBase::FillStyle CanvasBase::FillStyle::radial(const QColor &from, const QColor &to, const QRect &bounds)
+{
+	FillStyle style(from);
+	style.type = RADIAL;
+	style.endColor = to;
+	style.start = bounds.center();
+	style.end = bounds.topLeft();
+	return style;
+}
+
+CanvasBase::FillStyle CanvasBase::FillStyle::hatch(const QColor &color, int interval, int angle, int lineWidth, bool cross)
+{
+	FillStyle style(color);
+	style.type = HATCH;
+	style.interval = interval;
+	style.angle = angle;
+	style.lineWidth = lineWidth;
+	style.cross = cross;
+	return style;
+}
+
+QRect CanvasBase::boundingRect(const QVector<Edge> &polygon)
+{
+	QRect bounds;
+	for (const Edge &e : polygon)
+		bounds = bounds.united(QRect(e.p1, e.p2).normalized());
+	return bounds;
+}
+
+QVector<CanvasBase::Node> CanvasBase::constructET(const QVector<Edge> &edges) const
+{
+	QVector<Node> ET;
+	for (const Edge &edge : edges)
+	{
+		// ignore horizontal edge
+		if (edge.p1.y() == edge.p2.y())
+			continue;
+
+		QPoint lowerPoint = (edge.p1.y() < edge.p2.y()) ? edge.p1 : edge.p2;
+		QPoint upperPoint = (edge.p1.y() < edge.p2.y()) ? edge.p2 : edge.p1;
+
+		Node node;
+		node.yMin = lowerPoint.y();
+		node.yMax = upperPoint.y();
+		node.x = lowerPoint.x();
+		node.deltaX = (double)(upperPoint.x() - lowerPoint.x()) / (double)(upperPoint.y() - lowerPoint.y());
+		node.direction = edge.p1.y() < edge.p2.y() ? 1 : -1;
+		ET.push_back(node);
+	}
+	std::sort(ET.begin(), ET.end(), [](const Node &a, const Node &b) { return a.yMin < b.yMin; });
+	return ET;
+}
+
+void CanvasBase::swapTemp(QVector<Temp> &temp) const
+{
+	for (int i = 0; i < temp.size(); ++i)
+	{
+		int t = temp[i].x;
+		temp[i].x = temp[i].y;
+		temp[i].y = t;
+	}
+}
+
+void CanvasBase::flipY(QVector<Temp> &temp, int centerY) const
+{
+	for (int i = 0; i < temp.size(); ++i)
+	{
+		temp[i].y = 2 * centerY - temp[i].y;
+	}
+}
+
+template <class Format>
+BasicCanvas<Format>::BasicCanvas(int width, int height) : CanvasBase(width, height), STRIDE(Format::bytesPerLine(width))
+{
+	// init pixels, every row is a single white run
+	Row white;
+	white.runs.push_back(Run(WIDTH, Format::fromRgb(qRgb(255, 255, 255))));
+	rows.fill(white, HEIGHT);
+	int count = qMin(HOT_ROWS, HEIGHT);
+	hot.resize(count * STRIDE);
+	slotRow.fill(-1, count);
+	slotUsed.fill(0, count);
+}
+
+template <class Format>
+uchar *BasicCanvas<Format>::hotLine(int y)
+{
+	Row &row = rows[y];
+	if (row.raw.size())
+		return row.raw.data();
+	if (row.slot < 0)
+	{
+		// free slots are never used, so they come first
+		int slot = 0;
+		for (int i = 1; i < slotUsed.size(); ++i)
+		{
+			if (slotUsed[i] < slotUsed[slot])
+				slot = i;
+		}
+		if (slotRow[slot] >= 0)
+			compress(slotRow[slot]);
+
+		uchar *pixels = hot.data() + slot * STRIDE;
+		int start = 0;
+		for (const Run &run : row.runs)
+		{
+			Format::fillSpan(pixels, start, run.end - 1, run.color);
+			start = run.end;
+		}
+		row.runs.clear();
+		row.slot = slot;
+		slotRow[slot] = y;
+	}
+	slotUsed[row.slot] = ++clock;
+	return hot.data() + row.slot * STRIDE;
+}
+
+template <class Format>
+void BasicCanvas<Format>::compress(int y)
+{
+	Row &row = rows[y];
+	pack(row, hot.constData() + row.slot * STRIDE);
+	release(row);
+}
+
+template <class Format>
+void BasicCanvas<Format>::release(Row &row)
+{
+	if (row.slot < 0)
+		return;
+	slotRow[row.slot] = -1;
+	slotUsed[row.slot] = 0;
+	row.slot = -1;
+}
+
+template <class Format>
+void BasicCanvas<Format>::pack(Row &row, const uchar *pixels) const
+{
+	if (encode(pixels, row.runs))
+	{
+		row.raw.clear();
+		return;
+	}
+	// photos and dithered rows are about a run per pixel
+	row.runs.clear();
+	row.raw.resize(STRIDE);
+	memcpy(row.raw.data(), pixels, STRIDE);
+}
+
+template <class Format>
+bool BasicCanvas<Format>::encode(const uchar *pixels, QVector<Run> &runs) const
+{
+	int limit = (STRIDE - 1) / int(sizeof(Run)); // most runs smaller than the bytes
+	runs.clear();
+	Pixel color = Format::load(pixels, 0);
+	for (int x = 1; x < WIDTH; ++x)
+	{
+		Pixel p = Format::load(pixels, x);
+		if (p != color)
+		{
+			if (runs.size() + 1 >= limit)
+				return false;
+			runs.push_back(Run(x, color));
+			color = p;
+		}
+	}
+	runs.push_back(Run(WIDTH, color));
+	return true;
+}
+
+template <class Format>
+typename BasicCanvas<Format>::Pixel BasicCanvas<Format>::load(int x, int y) const
+{
+	const Row &row = rows[y];
+	if (row.slot >= 0)
+		return Format::load(hot.constData() + row.slot * STRIDE, x);
+	if (row.raw.size())
+		return Format::load(row.raw.constData(), x);
+	return row.runs[runAt(row.runs, x)].color;
+}
+
+template <class Format>
+void BasicCanvas<Format>::readLine(int y, int x1, int x2, QRgb *out) const
+{
+	const Row &row = rows[y];
+	if (row.slot >= 0 || row.raw.size())
+	{
+		Format::toRgb(row.raw.size() ? row.raw.constData() : hot.constData() + row.slot * STRIDE, x1, x2, out);
+		return;
+	}
+
+	// a color per run, cold rows are not unpacked
+	for (int i = runAt(row.runs, x1); x1 <= x2; ++i)
+	{
+		int end = qMin(row.runs[i].end - 1, x2);
+		std::fill(out, out + end - x1 + 1, Format::toRgb(row.runs[i].color));
+		out += end - x1 + 1;
+		x1 = end + 1;
+	}
+}
+
+template <class Format>
+void BasicCanvas<Format>::fillRun(int y, int x1, int x2, Pixel p)
+{
+	Row &row = rows[y];
+	if (x1 == 0 && x2 == WIDTH - 1) // a single run, whatever the row was
+	{
+		release(row);
+		row.raw.clear();
+		row.runs.fill(Run(WIDTH, p), 1);
+		return;
+	}
+	if (row.slot >= 0 || row.raw.size() || row.runs.size() > MAX_COLD_RUNS)
+	{
+		Format::fillSpan(hotLine(y), x1, x2, p);
+		return;
+	}
+
+	QVector<Run> &runs = row.runs;
+	int first = runAt(runs, x1);
+	int last = runAt(runs, x2);
+	if (first == last && runs[first].color == p) // nothing would change
+		return;
+
+	// runs from first to last are replaced in place by what is left of them around the span, joining equal neighbours
+	Run pieces[3];
+	int count = 0;
+	int start = first, stop = last + 1;
+	if ((first ? runs[first - 1].end : 0) < x1)
+		pieces[count++] = Run(x1, runs[first].color);
+	else if (first && runs[first - 1].color == p)
+		--start;
+	if (count && pieces[count - 1].color == p)
+		pieces[count - 1].end = x2 + 1;
+	else
+		pieces[count++] = Run(x2 + 1, p);
+	if (runs[last].end > x2 + 1)
+	{
+		if (runs[last].color == p)
+			pieces[count - 1].end = runs[last].end;
+		else
+			pieces[count++] = runs[last];
+	}
+	else if (stop < runs.size() && runs[stop].color == p)
+	{
+		pieces[count - 1].end = runs[stop].end;
+		++stop;
+	}
+
+	if (count > stop - start)
+		runs.insert(start, count - (stop - start), Run());
+	else if (count < stop - start)
+		runs.remove(start, stop - start - count);
+	for (int i = 0; i < count; ++i)
+		runs[start + i] = pieces[i];
+}
+
+template <class Format>
+void BasicCanvas<Format>::copyRun(int fromY, int fromX, int toY, int toX, int count)
+{
+	const Row &from = rows[fromY];
+	if (from.slot >= 0 || from.raw.size())
+	{
+		// touch the source first, so unpacking the target does not evict it
+		const uchar *source = hotLine(fromY);
+		Format::copySpan(source, fromX, hotLine(toY), toX, count);
+		return;
+	}
+
+	// pieces of cold runs are copied before any is written, the rows may be the same
+	QVector<Run> pieces;
+	for (int i = runAt(from.runs, fromX); i < from.runs.size() && (i ? from.runs[i - 1].end : 0) < fromX + count; ++i)
+		pieces.push_back(Run(qMin(from.runs[i].end, fromX + count) - fromX + toX, from.runs[i].color));
+	int start = toX;
+	for (const Run &piece : pieces)
+	{
+		fillRun(toY, start, piece.end - 1, piece.color);
+		start = piece.end;
+	}
+}
+
+template <class Format>
+QImage BasicCanvas<Format>::toImage() const
+{
+	QImage image(WIDTH, HEIGHT, QImage::Format_RGB32);
+	for (int y = 0; y < HEIGHT; ++y)
+	{
+		QRgb *target = reinterpret_cast<QRgb *>(image.scanLine(HEIGHT - y - 1));
+		readLine(y, 0, WIDTH - 1, target);
+		for (int x = 0; x < WIDTH; ++x)
+			target[x] |= 0xff000000; // opaque, like QColor::rgb()
+	}
+	return image;
+}
+
+template <class Format>
+void BasicCanvas<Format>::load(const QImage &image)
+{
+	// every row is packed straight into runs or raw bytes
+	QImage source = image.convertToFormat(QImage::Format_ARGB32);
+	QVector<uchar> pixels(STRIDE);
+	for (int y = 0; y < HEIGHT; ++y)
+	{
+		const QRgb *from = reinterpret_cast<const QRgb *>(source.constScanLine(HEIGHT - y - 1));
+		for (int x = 0; x < WIDTH; ++x)
+			Format::store(pixels.data(), x, Format::fromRgb(from[x]));
+		release(rows[y]);
+		pack(rows[y], pixels.constData());
+	}
+}
+
+template <class Format>
+void BasicCanvas<Format>::merge(const QVector<Temp> &temp)
+{
+	// temp pixels of a stroke share a color, so convert it once
+	QColor last;
+	Pixel p = toPixel(last);
+	for (int i = 0; i < temp.size(); ++i)
+	{
+		// judge whether current point is inside canvas
+		if (!contains(temp[i].x, temp[i].y))
+			continue;
+		if (temp[i].color.alpha() < 255)
+		{
+			// anti-aliased edge, coverage is in alpha
+			Pixel under = load(temp[i].x, temp[i].y);
+			fillRun(temp[i].y, temp[i].x, temp[i].x, Format::fromRgb(blend(temp[i].color.rgba(), Format::toRgb(under))));
+			continue;
+		}
+		if (temp[i].color != last)
+		{
+			last = temp[i].color;
+			p = toPixel(last);
+		}
+		fillRun(temp[i].y, temp[i].x, temp[i].x, p);
+	}
+}
+
+template <class Format>
+QRect BasicCanvas<Format>::floodFill(int x, int y, const QColor &color, const FloodRule &rule, const Mask *clip)
+{
+	if (!contains(x, y))
+		return QRect();
+	if (rule.tolerance == 0 && load(x, y) == toPixel(color)) // nothing would change
+		return QRect();
+	return fillMask(selectRegion(x, y, rule, clip), color);
+}
+
+template <class Format>
+QRect BasicCanvas<Format>::fillMask(const Mask &mask, const FillStyle &style)
+{
+	Shader shader = prepare(style);
+	QRect bounds = mask.boundingRect();
+	for (int y = bounds.top(); y <= bounds.bottom(); ++y)
+	{
+		int x = mask.nextSet(y, bounds.left());
+		while (x <= bounds.right())
+		{
+			int end = mask.nextClear(y, x);
+			fillSpan(y, x, end - 1, shader);
+			x = mask.nextSet(y, end);
+		}
+	}
+	return bounds;
+}
+
+template <class Format>
+typename BasicCanvas<Format>::Shader BasicCanvas<Format>::prepare(const FillStyle &style) const
+{
+	Shader shader;
+	shader.type = style.type;
+	shader.color = toPixel(style.color);
+	shader.start = style.start;
+	if (style.type == FillStyle::SOLID)
+		return shader;
+	if (style.type == FillStyle::HATCH)
+	{
+		// integer normal of lines, so a pixel is on a line if (a * x + b * y) mod tileSize < width,
+		// and the pattern repeats every tileSize pixels in both directions
+		// the normal closest to the angle whose tile still fits, horizontal lines always fit
+		double radians = qDegreesToRadians(double(style.angle));
+		double normalX = -qSin(radians), normalY = qCos(radians);
+		int a = 0, b = 1;
+		double best = -2;
+		for (int p = -MAX_HATCH_STEP; p <= MAX_HATCH_STEP; ++p)
+		{
+			for (int q = -MAX_HATCH_STEP; q <= MAX_HATCH_STEP; ++q)
+			{
+				double length = qSqrt(double(p * p + q * q));
+				if (length == 0 || ((p && q) && (style.interval + 1) * length > MAX_TILE_SIZE))
+					continue;
+				double cosine = (p * normalX + q * normalY) / length;
+				if (cosine > best + 1e-12)
+				{
+					best = cosine;
+					a = p;
+					b = q;
+				}
+			}
+		}
+		int divisor = qAbs(a), rest = qAbs(b);
+		while (rest)
+		{
+			int t = divisor % rest;
+			divisor = rest;
+			rest = t;
+		}
+		a /= divisor;
+		b /= divisor;
+		double length = qSqrt(double(a * a + b * b));
+		shader.tileSize = qMax(1, qRound((style.interval + 1) * length));
+		int width = qBound(1, qRound(style.lineWidth * length), shader.tileSize);
+
+		int size = shader.tileSize;
+		shader.tile.fill(0, size * size);
+		shader.tileRowRuns.fill(0, size + 1);
+		for (int y = 0; y < size; ++y)
+		{
+			quint8 *row = shader.tile.data() + y * size;
+			for (int x = 0; x < size; ++x)
+			{
+				bool on = ((a * x + b * y) % size + size) % size < width;
+				if (style.cross)
+					on = on || ((b * x - a * y) % size + size) % size < width;
+				row[x] = on;
+			}
+			shader.tileRowRuns[y] = shader.tileRuns.size();
+			for (int x = 0; x < size; ++x)
+			{
+				if (!row[x])
+					continue;
+				shader.tileRuns.push_back(x);
+				while (x < size && row[x])
+					++x;
+				shader.tileRuns.push_back(x);
+			}
+		}
+		shader.tileRowRuns[size] = shader.tileRuns.size();
+		return shader;
+	}
+
+	// colors of the gradient, looked up by 8 bit position
+	shader.ramp.resize(256);
+	for (int i = 0; i < 256; ++i)
+	{
+		shader.ramp[i] = Format::fromRgb(qRgba(
+				style.color.red() + (style.endColor.red() - style.color.red()) * i / 255,
+				style.color.green() + (style.endColor.green() - style.color.green()) * i / 255,
+				style.color.blue() + (style.endColor.blue() - style.color.blue()) * i / 255,
+				style.color.alpha() + (style.endColor.alpha() - style.color.alpha()) * i / 255));
+	}
+
+	QPoint axis = style.end - style.start;
+	shader.axisX = axis.x();
+	shader.axisY = axis.y();
+	shader.axisLength2 = shader.axisX * shader.axisX + shader.axisY * shader.axisY;
+	double radius = qSqrt(double(shader.axisLength2));
+	shader.radialScale = radius > 0 ? float(256 / radius) : 0;
+	return shader;
+}
+
+template <class Format>
+void BasicCanvas<Format>::fillSpan(int y, int x1, int x2, const Shader &shader)
+{
+	switch (shader.type)
+	{
+	case FillStyle::LINEAR:
+	{
+		// position along the axis in 32.32 fixed point, stepped by forward difference
+		if (shader.axisLength2 == 0)
+		{
+			fillRun(y, x1, x2, shader.ramp[0]);
+			break;
+		}
+		const qint64 one = Q_INT64_C(1) << 32;
+		qint64 position = ((x1 - shader.start.x()) * shader.axisX + (y - shader.start.y()) * shader.axisY) * one / shader.axisLength2;
+		qint64 delta = shader.axisX * one / shader.axisLength2;
+		if (delta == 0) // vertical axis, a row has one color
+		{
+			fillRun(y, x1, x2, shader.ramp[qBound<qint64>(0, position >> 24, 255)]);
+			break;
+		}
+		uchar *pixels = hotLine(y);
+		for (int x = x1; x <= x2; ++x)
+		{
+			Format::store(pixels, x, shader.ramp[qBound<qint64>(0, position >> 24, 255)]);
+			position += delta;
+		}
+		break;
+	}
+	case FillStyle::RADIAL:
+	{
+		uchar *pixels = hotLine(y);
+		int x = x1;
+		float dy = float(y - shader.start.y());
+#ifdef __SSE2__
+		// 4 distances at a time
+		__m128 dy2 = _mm_set1_ps(dy * dy);
+		__m128 scale = _mm_set1_ps(shader.radialScale);
+		__m128 last = _mm_set1_ps(255);
+		__m128 dx = _mm_add_ps(_mm_set1_ps(float(x1 - shader.start.x())), _mm_setr_ps(0, 1, 2, 3));
+		__m128 four = _mm_set1_ps(4);
+		for (; x + 3 <= x2; x += 4)
+		{
+			__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), dy2));
+			__m128i index = _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(distance, scale), last));
+			int indexes[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(indexes), index);
+			Format::store(pixels, x, shader.ramp[indexes[0]]);
+			Format::store(pixels, x + 1, shader.ramp[indexes[1]]);
+			Format::store(pixels, x + 2, shader.ramp[indexes[2]]);
+			Format::store(pixels, x + 3, shader.ramp[indexes[3]]);
+			dx = _mm_add_ps(dx, four);
+		}
+#endif
+		for (; x <= x2; ++x)
+		{
+			float dx = float(x - shader.start.x());
+			Format::store(pixels, x, shader.ramp[qMin(255, int(qSqrt(dx * dx + dy * dy) * shader.radialScale))]);
+		}
+		break;
+	}
+	case FillStyle::HATCH:
+	{
+		// the tile row repeats every tileSize pixels from x = 0
+		int size = shader.tileSize;
+		int row = y % size;
+		const int *runs = shader.tileRuns.constData() + shader.tileRowRuns[row];
+		int count = (shader.tileRowRuns[row + 1] - shader.tileRowRuns[row]) / 2;
+		if (count == 1 && runs[0] == 0 && runs[1] == size)
+		{
+			// horizontal lines or no interval, the row is solid and cold rows stay runs
+			fillRun(y, x1, x2, shader.color);
+			break;
+		}
+		uchar *pixels = hotLine(y);
+		if (count * 16 <= size)
+		{
+			// few lines cross the row, stamp each run of them
+			for (int origin = x1 - x1 % size; origin <= x2; origin += size)
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					int from = qMax(x1, origin + runs[2 * i]);
+					int to = qMin(x2, origin + runs[2 * i + 1] - 1);
+					if (from <= to)
+						Format::fillSpan(pixels, from, to, shader.color);
+				}
+			}
+		}
+		else
+		{
+			// dense lines, write the tile row through its mask
+			const quint8 *pattern = shader.tile.constData() + row * size;
+			for (int x = x1; x <= x2;)
+			{
+				int i = x % size;
+				int end = qMin(x2, x + size - i - 1);
+				Format::maskSpan(pixels, x, end, pattern + i, shader.color);
+				x = end + 1;
+			}
+		}
+		break;
+	}
+	default:
+		fillRun(y, x1, x2, shader.color);
+		break;
+	}
+}
+
+template <class Format>
+CanvasBase::Block BasicCanvas<Format>::copyRect(const QRect &rect) const
+{
+	QRect r = rect.intersected(QRect(0, 0, WIDTH, HEIGHT));
+	Block block(r.width(), r.height());
+	for (int y = 0; y < block.height; ++y)
+		readLine(r.top() + y, r.left(), r.right(), block.scanLine(y));
+	return block;
+}
+
+template <class Format>
+QRect BasicCanvas<Format>::pasteBlock(const Block &block, int x, int y)
+{
+	QRect r = QRect(x, y, block.width, block.height).intersected(QRect(0, 0, WIDTH, HEIGHT));
+	for (int row = r.top(); row <= r.bottom(); ++row)
+	{
+		const QRgb *source = block.scanLine(row - y) + (r.left() - x);
+		uchar *target = hotLine(row);
+		for (int i = r.left(); i <= r.right(); ++i)
+			Format::store(target, i, Format::fromRgb(*source++));
+	}
+	return r;
+}
+
+template <class Format>
+QRect BasicCanvas<Format>::fillRect(const QRect &rect, const QColor &color)
+{
+	QRect r = rect.intersected(QRect(0, 0, WIDTH, HEIGHT));
+	Pixel p = toPixel(color);
+	for (int y = r.top(); y <= r.bottom(); ++y)
+		fillRun(y, r.left(), r.right(), p);
+	return r;
+}
+
+template <class Format>
+QRect BasicCanvas<Format>::moveRect(const QRect &rect, int dx, int dy, const QColor &fillColor)
+{
+	QRect bounds(0, 0, WIDTH, HEIGHT);
+	QRect source = rect.intersected(bounds);
+	if (source.isEmpty())
+		return QRect();
+	QRect target = source.translated(dx, dy).intersected(bounds);
+
+	// copy rows away from the target first, so no source row is overwritten before it is read
+	if (!target.isEmpty())
+	{
+		int first = dy > 0 ? target.bottom() : target.top();
+		int last = dy > 0 ? target.top() : target.bottom();
+		int step = dy > 0 ? -1 : 1;
+		for (int y = first; y != last + step; y += step)
+			copyRun(y - dy, target.left() - dx, y, target.left(), target.width()); // overlapping if dy is 0
+	}
+
+	// fill vacated pixels, which are source pixels not covered by the moved rect
+	QRect moved = source.translated(dx, dy);
+	Pixel p = toPixel(fillColor);
+	for (int y = source.top(); y <= source.bottom(); ++y)
+	{
+		if (y < moved.top() || y > moved.bottom())
+		{
+			fillRun(y, source.left(), source.right(), p);
+			continue;
+		}
+		int left = dx > 0 ? source.left() : qMax(source.left(), moved.right() + 1);
+		int right = dx > 0 ? qMin(source.right(), moved.left() - 1) : source.right();
+		if (dx != 0 && left <= right)
+			fillRun(y, left, right, p);
+	}
+	return target.united(source);
+}
+
+template <class Format>
+Mask BasicCanvas<Format>::selectRegion(int x, int y, const FloodRule &rule, const Mask *clip) const
+{
+	Mask region(WIDTH, HEIGHT);
+	if (!contains(x, y) || (clip && !clip->test(x, y)))
+		return region;
+
+	// bits of matched pixels, a row is computed when the search first reaches it
+	QRgb seed = Format::toRgb(load(x, y));
+	Mask match(WIDTH, HEIGHT);
+	QVector<bool> matched(HEIGHT, false);
+	QVector<QRgb> packed(WIDTH);
+	int words = (WIDTH + 63) / 64;
+	auto matchRow = [&](int row) {
+		if (matched[row])
+			return;
+		matched[row] = true;
+		const Row &r = rows[row];
+		if (r.runs.isEmpty())
+		{
+			readLine(row, 0, WIDTH - 1, packed.data());
+			matchPixels(packed.constData(), WIDTH, seed, rule, match.row(row));
+		}
+		else
+		{
+			// one test per run of a cold row
+			int start = 0;
+			for (const Run &run : r.runs)
+			{
+				QRgb color = Format::toRgb(run.color);
+				quint64 ok = 0;
+				matchPixels(&color, 1, seed, rule, &ok);
+				if (ok)
+					match.setSpan(row, start, run.end - 1);
+				start = run.end;
+			}
+		}
+		quint64 *bits = match.row(row);
+		if (clip)
+		{
+			const quint64 *inside = clip->row(row);
+			for (int w = 0; w < words; ++w)
+				bits[w] &= inside[w];
+		}
+	};
+
+	// scanline seed fill, every run of matched pixels is taken as a whole
+	QVector<QPoint> seeds;
+	seeds.push_back(QPoint(x, y));
+	matchRow(y);
+	while (seeds.size())
+	{
+		QPoint p = seeds.last();
+		seeds.removeLast();
+		if (region.test(p.x(), p.y()))
+			continue;
+		int left = match.prevClear(p.y(), p.x()) + 1;
+		int right = match.nextClear(p.y(), p.x()) - 1;
+		region.setSpan(p.y(), left, right);
+
+		// look for runs touching this one in the rows below and above
+		int from = rule.eightConnected ? max(0, left - 1) : left;
+		int to = rule.eightConnected ? min(WIDTH - 1, right + 1) : right;
+		for (int ny = p.y() - 1; ny <= p.y() + 1; ny += 2)
+		{
+			if (ny < 0 || ny >= HEIGHT)
+				continue;
+			matchRow(ny);
+			int nx = match.nextSet(ny, from);
+			while (nx <= to)
+			{
+				if (!region.test(nx, ny))
+					seeds.push_back(QPoint(nx, ny));
+				nx = match.nextSet(ny, match.nextClear(ny, nx));
+			}
+		}
+	}
+	return region;
+}
+
+template <class Format>
+QRgb BasicCanvas<Format>::shade(int x, int y, const Shader &shader)
+{
+	switch (shader.type)
+	{
+	case FillStyle::LINEAR:
+	{
+		if (shader.axisLength2 == 0)
+			return Format::toRgb(shader.ramp[0]);
+		const qint64 one = Q_INT64_C(1) << 32;
+		qint64 position = ((x - shader.start.x()) * shader.axisX + (y - shader.start.y()) * shader.axisY) * one / shader.axisLength2;
+		return Format::toRgb(shader.ramp[qBound<qint64>(0, position >> 24, 255)]);
+	}
+	case FillStyle::RADIAL:
+	{
+		float dx = float(x - shader.start.x());
+		float dy = float(y - shader.start.y());
+		return Format::toRgb(shader.ramp[qMin(255, int(qSqrt(dx * dx + dy * dy) * shader.radialScale))]);
+	}
+	case FillStyle::HATCH:
+		return shader.tile[(y % shader.tileSize) * shader.tileSize + x % shader.tileSize] ? Format::toRgb(shader.color) : 0;
+	default:
+		return Format::toRgb(shader.color);
+	}
+}
+
+template <class Format>
+void BasicCanvas<Format>::writeLine(int y, int x1, int x2, const QRgb *pixels)
+{
+	// edge pixels are few, so cold rows stay runs
+	for (int x = x1; x <= x2; ++x)
+		fillRun(y, x, x, Format::fromRgb(*pixels++));
+}
+
+template <class Format>
+void BasicCanvas<Format>::fillSmooth(const QVector<Edge> &polygon, const Shader &shader, FillRule rule)
+{
+	// pixel (x, y) covers [x, x + 1) * [y, y + 1) here, so centers are where the aliased fill samples
+	struct Segment
+	{
+		float x0, y0, x1, y1; // y0 < y1
+		float direction;
+	};
+
+	// edges are split at both sides of canvas and clamped, pieces beyond a side still count for pixels inside
+	QVector<Segment> segments;
+	for (const Edge &e : polygon)
+	{
+		if (e.p1.y() == e.p2.y())
+			continue;
+		bool up = e.p1.y() < e.p2.y();
+		QPoint low = up ? e.p1 : e.p2;
+		QPoint high = up ? e.p2 : e.p1;
+		float ax = low.x() + 0.5f, ay = low.y() + 0.5f;
+		float bx = high.x() + 0.5f, by = high.y() + 0.5f;
+		float ys[4];
+		int n = 0;
+		ys[n++] = ay;
+		for (float side : {0.0f, float(WIDTH)})
+		{
+			if ((ax - side) * (bx - side) < 0)
+				ys[n++] = ay + (side - ax) * (by - ay) / (bx - ax);
+		}
+		ys[n++] = by;
+		std::sort(ys, ys + n);
+		for (int i = 0; i + 1 < n; ++i)
+		{
+			Segment s;
+			s.y0 = ys[i];
+			s.y1 = ys[i + 1];
+			s.x0 = qBound(0.0f, ax + (s.y0 - ay) * (bx - ax) / (by - ay), float(WIDTH));
+			s.x1 = qBound(0.0f, ax + (s.y1 - ay) * (bx - ax) / (by - ay), float(WIDTH));
+			s.direction = up ? 1 : -1;
+			if (s.y0 < s.y1)
+				segments.push_back(s);
+		}
+	}
+	if (segments.isEmpty())
+		return;
+	std::sort(segments.begin(), segments.end(), [](const Segment &a, const Segment &b) { return a.y0 < b.y0; });
+
+	// one row of accumulation, only the touched range is resolved and cleared
+	QVector<float> acc(WIDTH + 2, 0);
+	QVector<quint8> coverage(WIDTH + 2);
+	QVector<QRgb> under(WIDTH), colors(WIDTH);
+	QVector<quint8> alphas(WIDTH);
+	QVector<Segment> active;
+	int next = 0;
+	for (int y = max(0, qFloor(segments[0].y0)); y < HEIGHT && (next < segments.size() || active.size()); ++y)
+	{
+		int kept = 0;
+		for (int i = 0; i < active.size(); ++i)
+		{
+			if (active[i].y1 > y)
+				active[kept++] = active[i];
+		}
+		active.resize(kept);
+		for (; next < segments.size() && segments[next].y0 < y + 1; ++next)
+		{
+			if (segments[next].y1 > y)
+				active.push_back(segments[next]);
+		}
+
+		// deposit the piece of every edge inside this row
+		int lo = WIDTH + 1, hi = 0;
+		for (const Segment &s : active)
+		{
+			float ya = qMax(float(y), s.y0);
+			float yb = qMin(float(y + 1), s.y1);
+			if (yb <= ya)
+				continue;
+			float dxdy = (s.x1 - s.x0) / (s.y1 - s.y0);
+			float xa = qBound(0.0f, s.x0 + (ya - s.y0) * dxdy, float(WIDTH));
+			float xb = qBound(0.0f, s.x0 + (yb - s.y0) * dxdy, float(WIDTH));
+			accumulate(acc.data(), xa, xb, (yb - ya) * s.direction);
+			lo = min(lo, qFloor(qMin(xa, xb)));
+			hi = max(hi, qCeil(qMax(xa, xb)) + 1);
+		}
+		if (lo > hi)
+			continue;
+		hi = min(hi, WIDTH + 1);
+		resolveCoverage(acc.data() + lo, coverage.data() + lo, hi - lo + 1, rule == NON_ZERO);
+
+		// covered spans are filled as usual, partly covered pixels are blended by coverage
+		int last = min(hi, WIDTH - 1);
+		int x = lo;
+		while (x <= last)
+		{
+			int c = coverage[x];
+			int end = x;
+			if (c == 255)
+			{
+				while (end < last && coverage[end + 1] == 255)
+					++end;
+				if (shader.drawsRow(y))
+					fillSpan(y, x, end, shader);
+			}
+			else if (c > 0)
+			{
+				while (end < last && coverage[end + 1] > 0 && coverage[end + 1] < 255)
+					++end;
+				int count = end - x + 1;
+				readLine(y, x, end, under.data());
+				for (int i = 0; i < count; ++i)
+				{
+					QRgb color = shade(x + i, y, shader);
+					colors[i] = color;
+					alphas[i] = quint8(mix(qAlpha(color), 0, coverage[x + i]));
+				}
+				blendPixels(under.data(), colors.constData(), alphas.constData(), count);
+				writeLine(y, x, end, under.constData());
+			}
+			x = end + 1;
+		}
+	}
+}
+
+template <class Format>
+void BasicCanvas<Format>::fill(const QVector<Edge> &polygon, const FillStyle &style, const QColor &borderColor, FillRule rule, bool antialiased)
+{
+	Shader shader = prepare(style);
+	if (antialiased)
+	{
+		fillSmooth(polygon, shader, rule);
+
+		// border is blended once
+		QVector<Temp> border;
+		getOutline(polygon, borderColor, true, border);
+		merge(border);
+		return;
+	}
+
+	QVector<Node> ET = constructET(polygon);
+
+	// AEL is sorted by x, edges leave it at yMax, so a vertex is counted once
+	QVector<Node> AEL;
+	int next = 0; // first edge in ET not added yet
+	int currentY = ET.size() ? shader.nextRow(max(0, ET[0].yMin)) : 0;
+	while ((next < ET.size() || AEL.size()) && currentY < HEIGHT)
+	{
+		// strip edges ended below currentY
+		int kept = 0;
+		for (int i = 0; i < AEL.size(); ++i)
+		{
+			if (AEL[i].yMax > currentY)
+				AEL[kept++] = AEL[i];
+		}
+		AEL.resize(kept);
+
+		// add edges starting here, or skipped below the canvas
+		for (; next < ET.size() && ET[next].yMin <= currentY; ++next)
+		{
+			if (ET[next].yMax <= currentY)
+				continue;
+			Node node = ET[next];
+			node.x += node.deltaX * (currentY - node.yMin);
+			AEL.push_back(node);
+		}
+		if (AEL.isEmpty())
+		{
+			if (next < ET.size())
+				currentY = shader.nextRow(ET[next].yMin);
+			continue;
+		}
+
+		// insertion sort, AEL is almost sorted after stepping x
+		for (int i = 1; i < AEL.size(); ++i)
+		{
+			Node node = AEL[i];
+			int j = i - 1;
+			for (; j >= 0 && node < AEL[j]; --j)
+				AEL[j + 1] = AEL[j];
+			AEL[j + 1] = node;
+		}
+
+		// draw spans between crossings that are inside by the rule
+		int winding = 0;
+		for (int i = 0; i + 1 < AEL.size(); ++i)
+		{
+			winding += AEL[i].direction;
+			if (rule == EVEN_ODD ? (i % 2 == 0) : (winding != 0))
+			{
+				int left = max(0, qCeil(AEL[i].x));
+				int right = min(WIDTH - 1, qFloor(AEL[i + 1].x));
+				if (left <= right)
+					fillSpan(currentY, left, right, shader);
+			}
+		}
+
+		// get x at the next row that draws, rows without hatch lines are jumped over
+		// and edges ending among them are stripped above
+		int nextY = shader.nextRow(currentY + 1);
+		for (auto &node : AEL)
+		{
+			node.x += node.deltaX * (nextY - currentY);
+		}
+		currentY = nextY;
+	}
+
+	// repaint border
+	QVector<Temp> border;
+	getOutline(polygon, borderColor, false, border);
+	merge(border);
+}
+
+// kernels of every format are compiled here
+template class BasicCanvas<Argb32>;
+template class BasicCanvas<Rgb565>;
+template class BasicCanvas<Indexed8>;
+template class BasicCanvas<Mono1>;
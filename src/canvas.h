@@ -0,0 +1,239 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <QColor>
+#include <QVector>
+#include <QPoint>
+#include <QPointF>
+#include <QRect>
+#include <QImage>
+#include <algorithm>
+#include "mask.h"
+#include "pixelformat.h"
+
+// format independent types and rasterizers of BasicCanvas
+class CanvasBase
+{
+public:
+	CanvasBase(int width, int height) : WIDTH(width), HEIGHT(height) {}
+
+	struct Temp // temp pixels
+	{
+		int x;
+		int y;
+		QColor color;
+		Temp(int x = 0, int y = 0, QColor color = QColor()) : x(x), y(y), color(color) {}
+	};
+
+	struct Edge
+	{
+		QPoint p1;
+		QPoint p2;
+		Edge(QPoint p1 = QPoint(), QPoint p2 = QPoint()) : p1(p1), p2(p2) {}
+	};
+
+	enum ToleranceMode
+	{
+		CHANNEL, // every channel differs by at most tolerance
+		DISTANCE // euclidean distance of channels is at most tolerance
+	};
+
+	struct FloodRule // which pixels belong to a flood region
+	{
+		int tolerance;
+		ToleranceMode mode;
+		bool eightConnected;
+		FloodRule(int tolerance = 0, ToleranceMode mode = CHANNEL, bool eightConnected = false) : tolerance(tolerance), mode(mode), eightConnected(eightConnected) {}
+	};
+
+	enum FillRule // which parts of a self-intersecting polygon are inside
+	{
+		EVEN_ODD, // odd number of edges on the left
+		NON_ZERO	// edges on the left do not cancel by direction
+	};
+
+	struct FillStyle // how fill spans are painted
+	{
+		enum Type
+		{
+			SOLID,
+			LINEAR,
+			RADIAL,
+			HATCH
+		};
+		Type type;
+		QColor color;		 // solid color, or color at start
+		QColor endColor; // color at end
+		QPoint start;		 // linear: start of axis, radial: center
+		QPoint end;			 // linear: end of axis, radial: a point on the outer circle
+		int interval = 0;	 // hatch: blank pixels between lines, 0 is solid
+		int angle = 0;		 // hatch: degrees counterclockwise, 0 is horizontal
+		int lineWidth = 1; // hatch
+		bool cross = false; // hatch: add lines perpendicular to angle
+		FillStyle(const QColor &color = QColor()) : type(SOLID), color(color) {}
+		static FillStyle linear(const QColor &from, const QColor &to, const QRect &bounds); // left to right of bounds
+		static FillStyle radial(const QColor &from, const QColor &to, const QRect &bounds); // center to corner of bounds
+		static FillStyle hatch(const QColor &color, int interval, int angle = 0, int lineWidth = 1, bool cross = false);
+	};
+
+	struct Block // pixels copied out of canvas, row 0 is the bottom, independent of the canvas format
+	{
+		int width;
+		int height;
+		QVector<QRgb> pixels;
+		Block(int width = 0, int height = 0) : width(width), height(height), pixels(width * height) {}
+		bool isEmpty() const { return width <= 0 || height <= 0; }
+		const QRgb *scanLine(int y) const { return pixels.constData() + y * width; }
+		QRgb *scanLine(int y) { return pixels.data() + y * width; }
+	};
+
+	int width() const { return WIDTH; }
+	int height() const { return HEIGHT; }
+	bool contains(int x, int y) const { return x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT; }
+
+	// rasterizers, results are in canvas coordinates and may be out of canvas
+	void getLine(int x1, int y1, int x2, int y2, const QColor &color, QVector<Temp> &result) const; // result is cleared first
+	void getRect(int x1, int y1, int x2, int y2, const QColor &color, QVector<Temp> &result) const; // border is appended to result
+	QVector<Edge> getEllipse(int x1, int y1, int x2, int y2) const; // polygon approximation inside the rect
+	void getPolyline(const QVector<QPoint> &vertices, const QColor &color, QVector<Temp> &result) const; // connected, result is cleared first
+	void getSmoothLine(int x1, int y1, int x2, int y2, const QColor &color, QVector<Temp> &result) const; // anti-aliased by Wu's algorithm, coverage is in alpha, result is cleared first
+	void getSmoothPolyline(const QVector<QPoint> &vertices, const QColor &color, QVector<Temp> &result) const; // anti-aliased, result is cleared first
+	void getOutline(const QVector<Edge> &edges, const QColor &color, bool antialiased, QVector<Temp> &result) const; // lines of edges, anti-aliased ones joined, result is cleared first
+	static void joinCoverage(QVector<Temp> &temp); // keep the most opaque of pixels at the same place
+	static QRgb blend(QRgb color, QRgb under) // color over under, alpha of color is its coverage
+	{
+		int a = qAlpha(color);
+		return qRgba(mix(qRed(color), qRed(under), a), mix(qGreen(color), qGreen(under), a), mix(qBlue(color), qBlue(under), a), mix(255, qAlpha(under), a));
+	}
+	static QRect boundingRect(const QVector<Edge> &polygon);
+	static void flattenBezier(QPointF p0, QPointF p1, QPointF p2, QPointF p3, QVector<QPoint> &vertices, int depth = 0); // adaptive subdivision, append end points of flat pieces
+
+protected:
+	const int WIDTH;
+	const int HEIGHT;
+
+	struct Node // edge crossing scanlines yMin <= y < yMax
+	{
+		int yMin;
+		int yMax;
+		double x; // at current scanline
+		double deltaX;
+		int direction; // 1 if p1 is lower, -1 otherwise
+		bool operator<(const Node &ano) const { return this->x < ano.x; }
+	};
+
+	void BresenhamLine(int x1, int y1, int x2, int y2, const QColor &color, QVector<Temp> &result) const; // x1 & y1: left bottom point, x2 & y2: right top point
+	QVector<Node> constructET(const QVector<Edge> &edges) const; // sorted by yMin, horizontal edges are ignored
+	void swapTemp(QVector<Temp> &temp) const; // temp[].x <-> temp[].y
+	void flipY(QVector<Temp> &temp, int centerY) const; // temp[].y = 2 * centerY - temp[].y
+
+	int max(int a, int b) const { return a > b ? a : b; }
+	int min(int a, int b) const { return a < b ? a : b; }
+	int abs(int a) const { return a > 0 ? a : -a; }
+	static int mix(int a, int b, int alpha) // (a * alpha + b * (255 - alpha)) / 255, rounded
+	{
+		int x = a * alpha + b * (255 - alpha) + 128;
+		return (x + (x >> 8)) >> 8;
+	}
+};
+
+// pixels stored in Format, see pixelformat.h, shared by Scene and BatchRenderer
+// instantiated in canvas.cpp for Argb32, Rgb565, Indexed8 and Mono1
+template <class Format>
+class BasicCanvas : public CanvasBase
+{
+public:
+	typedef typename Format::Pixel Pixel;
+
+	BasicCanvas(int width = 800, int height = 600);
+
+	QColor pixel(int x, int y) const { return QColor::fromRgba(Format::toRgb(load(x, y))); }
+	void readLine(int y, int x1, int x2, QRgb *out) const; // converted for blitting, x1 <= x2, both are inside, safe from worker threads
+	QImage toImage() const; // left top is (0, 0)
+	void load(const QImage &image); // left top is (0, 0), same size as canvas
+
+	// operations on permanent pixels
+	void merge(const QVector<Temp> &temp); // pixels out of canvas are ignored, translucent ones are blended
+	void fill(const QVector<Edge> &polygon, const FillStyle &style, const QColor &borderColor, FillRule rule = EVEN_ODD, bool antialiased = false); // scanline fill, then draw border over it, so callers do not merge the outline first
+	QRect floodFill(int x, int y, const QColor &color, const FloodRule &rule = FloodRule(), const Mask *clip = 0); // return changed area, empty if nothing changed
+	QRect fillMask(const Mask &mask, const FillStyle &style); // return changed area
+
+	// row-wise block transfers, rects are clipped to canvas, return changed area
+	Block copyRect(const QRect &rect) const;
+	QRect pasteBlock(const Block &block, int x, int y); // left bottom of block at (x, y)
+	QRect fillRect(const QRect &rect, const QColor &color);
+	QRect moveRect(const QRect &rect, int dx, int dy, const QColor &fillColor); // overlap-safe, vacated pixels get fillColor
+
+	Mask selectRegion(int x, int y, const FloodRule &rule = FloodRule(), const Mask *clip = 0) const; // region of (x, y) inside clip
+
+private:
+	struct Shader // FillStyle prepared for spans, so a pixel costs no float setup or color conversion
+	{
+		FillStyle::Type type;
+		Pixel color;
+		QVector<Pixel> ramp; // 256 colors of the gradient
+		QPoint start;
+		qint64 axisX; // linear: axis scaled so the position is 2^32 at end
+		qint64 axisY;
+		qint64 axisLength2;
+		float radialScale; // radial: ramp index per pixel of distance
+		int tileSize;			 // hatch: the pattern repeats every tileSize pixels in x and y
+		QVector<quint8> tile; // hatch: tileSize * tileSize, 1 on lines
+		QVector<int> tileRuns;	// hatch: start and end (exclusive) of each run of line pixels in the tile rows
+		QVector<int> tileRowRuns; // hatch: where the runs of each tile row start in tileRuns, tileSize + 1 entries
+		bool drawsRow(int y) const { return type != FillStyle::HATCH || tileRowRuns[y % tileSize + 1] > tileRowRuns[y % tileSize]; }
+		int nextRow(int y) const // first row from y on that draws, at most a tile away
+		{
+			int end = type == FillStyle::HATCH ? y + tileSize : y;
+			while (y < end && !drawsRow(y))
+				++y;
+			return y;
+		}
+	};
+
+	struct Run // pixels from end of the previous run to end - 1
+	{
+		int end;
+		Pixel color;
+		Run(int end = 0, Pixel color = Pixel()) : end(end), color(color) {}
+	};
+
+	struct Row // cold rows are runs, or packed bytes if runs would be larger, recently edited (hot) rows are unpacked in a slot
+	{
+		QVector<Run> runs;	// empty while hot or raw
+		QVector<uchar> raw; // STRIDE bytes while raw, edited in place
+		int slot = -1;
+	};
+
+	const int HOT_ROWS = 64;			// slots of unpacked rows
+	const int MAX_COLD_RUNS = 64; // a cold row with more runs is unpacked to be edited
+	const int STRIDE;							// bytes per unpacked row
+	const int MAX_HATCH_STEP = 32;	// bound of the integer normal of hatch lines, within 1 degree of any angle
+	const int MAX_TILE_SIZE = 1024; // of hatch tiles, very wide intervals get a coarser normal
+	QVector<Row> rows;						// left bottom is (0, 0), all white by default
+	QVector<uchar> hot;						// HOT_ROWS * STRIDE
+	QVector<int> slotRow;					// row in each slot, -1 if free
+	QVector<quint64> slotUsed;		// when each slot was last written, the smallest is evicted
+	quint64 clock = 0;
+
+	uchar *hotLine(int y); // unpack row y if it is runs, evicting the least recently used slot
+	void compress(int y);	 // pack hot row y and free its slot
+	void release(Row &row); // free the slot of row without packing it, if it is hot
+	void pack(Row &row, const uchar *pixels) const; // into runs, or raw bytes if they are smaller
+	bool encode(const uchar *pixels, QVector<Run> &runs) const; // false if runs would take STRIDE bytes or more
+	static int runAt(const QVector<Run> &runs, int x) { return std::upper_bound(runs.begin(), runs.end(), x, [](int x, const Run &run) { return x < run.end; }) - runs.begin(); }
+	Pixel load(int x, int y) const;
+	void fillRun(int y, int x1, int x2, Pixel p); // x1 <= x2, both are inside, splices runs of cold rows
+	void copyRun(int fromY, int fromX, int toY, int toX, int count); // overlap-safe
+
+	static Pixel toPixel(const QColor &color) { return Format::fromRgb(color.rgba()); }
+	Shader prepare(const FillStyle &style) const;
+	void fillSpan(int y, int x1, int x2, const Shader &shader); // x1 <= x2, both are inside
+	static QRgb shade(int x, int y, const Shader &shader); // color of one pixel, transparent between hatch lines
+	void writeLine(int y, int x1, int x2, const QRgb *pixels); // x1 <= x2, both are inside
+	void fillSmooth(const QVector<Edge> &polygon, const Shader &shader, FillRule rule); // by area coverage of pixels
+};
+
+typedef BasicCanvas<Argb32> Canvas; // what the window draws on
+
+#endif // CANVAS_H
@@ -0,0 +1,378 @@
+#include "journal.h"
+#include <QDebug>
+#include <QDir>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QtConcurrent>
+#include <QtEndian>
+
+static void writeStyle(QDataStream &out, const Canvas::FillStyle &style)
+{
+	out << qint32(style.type) << style.color << style.endColor << style.start << style.end;
+	out << qint32(style.interval) << qint32(style.angle) << qint32(style.lineWidth) << style.cross;
+}
+
+static Canvas::FillStyle readStyle(QDataStream &in)
+{
+	qint32 type, interval, angle, lineWidth;
+	Canvas::FillStyle style;
+	in >> type >> style.color >> style.endColor >> style.start >> style.end;
+	in >> interval >> angle >> lineWidth >> style.cross;
+	style.type = Canvas::FillStyle::Type(type);
+	style.interval = interval;
+	style.angle = angle;
+	style.lineWidth = lineWidth;
+	return style;
+}
+
+// as spans of rows
+static void writeMask(QDataStream &out, const Mask &mask)
+{
+	QVector<qint32> spans;
+	QRect bounds = mask.boundingRect();
+	for (int y = bounds.top(); y <= bounds.bottom(); ++y)
+	{
+		for (int x = mask.nextSet(y, bounds.left()); x <= bounds.right(); x = mask.nextSet(y, x))
+		{
+			int end = mask.nextClear(y, x);
+			spans << y << x << end - 1;
+			x = end;
+		}
+	}
+	out << qint32(mask.width()) << qint32(mask.height()) << qint32(spans.size() / 3);
+	for (qint32 value : spans)
+		out << value;
+}
+
+static Mask readMask(QDataStream &in)
+{
+	qint32 width, height, count;
+	in >> width >> height >> count;
+	Mask mask(width, height);
+	for (int i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+	{
+		qint32 y, x1, x2;
+		in >> y >> x1 >> x2;
+		if (y >= 0 && y < height && x1 >= 0 && x1 <= x2 && x2 < width)
+			mask.setSpan(y, x1, x2);
+	}
+	return mask;
+}
+
+Journal::Journal(const QString &directory) : directory(directory), lock(QDir(directory).filePath("journal.lock"))
+{
+	writer.setMaxThreadCount(1);
+	lock.setStaleLockTime(0); // stale only if the owner is gone, a long session keeps its lock
+}
+
+Journal::~Journal()
+{
+	writer.waitForDone();
+}
+
+QString Journal::logPath() const
+{
+	return QDir(directory).filePath("journal.log");
+}
+
+QString Journal::checkpointPath() const
+{
+	return QDir(directory).filePath("checkpoint.png");
+}
+
+bool Journal::open(Canvas *canvas)
+{
+	if (!QDir().mkpath(directory))
+	{
+		qWarning() << "can not create journal directory" << directory;
+		return false;
+	}
+	if (!lock.tryLock(0))
+	{
+		qWarning() << "journal is used by another instance, running without crash recovery";
+		return false;
+	}
+	bool restored = false;
+
+	// latest checkpoint, the log may still hold records before it
+	QImage image;
+	if (image.load(checkpointPath()) && image.width() == canvas->width() && image.height() == canvas->height())
+	{
+		canvas->load(image);
+		checkpointed = sequence = image.text("sequence").toULongLong();
+		restored = true;
+	}
+
+	log.setFileName(logPath());
+	if (!log.open(QIODevice::ReadWrite))
+	{
+		qWarning() << "can not open journal" << logPath();
+		return restored;
+	}
+	QByteArray data = log.readAll();
+	int offset = HEADER_SIZE;
+	if (data.size() < HEADER_SIZE || qFromBigEndian<quint32>(data.constData()) != MAGIC || qFromBigEndian<quint32>(data.constData() + 4) != VERSION)
+	{
+		if (data.size())
+			qWarning() << "unknown journal format, starting a new one";
+		offset = 0;
+	}
+
+	// replay records after the checkpoint, stop at the first broken one
+	while (offset && offset + RECORD_HEAD + RECORD_TAIL <= data.size())
+	{
+		const char *record = data.constData() + offset;
+		quint32 size = qFromBigEndian<quint32>(record);
+		if (size > quint32(data.size() - offset - RECORD_HEAD - RECORD_TAIL))
+			break;
+		if (qChecksum(record, RECORD_HEAD + size) != qFromBigEndian<quint16>(record + RECORD_HEAD + size))
+			break;
+		quint64 recordSequence = qFromBigEndian<quint64>(record + 4);
+		if (recordSequence >= sequence)
+		{
+			replay(canvas, quint8(record[12]), QByteArray(record + RECORD_HEAD, size));
+			sequence = recordSequence + 1;
+			restored = true;
+		}
+		offset += RECORD_HEAD + size + RECORD_TAIL;
+	}
+
+	// drop the torn tail, or write a new header
+	if (!offset)
+	{
+		log.resize(0);
+		log.seek(0);
+		QDataStream out(&log);
+		out << MAGIC << VERSION;
+		offset = HEADER_SIZE;
+	}
+	log.resize(offset);
+	log.seek(offset);
+	log.flush();
+	opened = true;
+	return restored;
+}
+
+void Journal::checkpoint(const Canvas *canvas)
+{
+	if (!opened || sequence == checkpointed)
+		return;
+	checkpointed = sequence;
+
+	// copy pixels here, encode in the writer
+	QImage image(canvas->width(), canvas->height(), QImage::Format_ARGB32);
+	for (int y = 0; y < canvas->height(); ++y)
+	{
+		canvas->readLine(canvas->height() - y - 1, 0, canvas->width() - 1, reinterpret_cast<QRgb *>(image.scanLine(y)));
+	}
+	quint64 checkpointSequence = sequence;
+	QtConcurrent::run(&writer, [this, image, checkpointSequence]() { saveCheckpoint(image, checkpointSequence); });
+}
+
+void Journal::discard()
+{
+	if (!lock.isLocked())
+		return;
+	writer.waitForDone();
+	log.close();
+	QFile::remove(logPath());
+	QFile::remove(checkpointPath());
+	opened = false;
+	lock.unlock();
+}
+
+void Journal::append(Type type, const QByteArray &payload)
+{
+	if (!opened)
+		return;
+	QByteArray record;
+	QDataStream out(&record, QIODevice::WriteOnly);
+	out << quint32(payload.size()) << quint64(sequence++) << quint8(type);
+	out.writeRawData(payload.constData(), payload.size());
+	out << qChecksum(record.constData(), record.size());
+	QtConcurrent::run(&writer, [this, record]() { write(record); });
+}
+
+void Journal::write(const QByteArray &record)
+{
+	if (log.write(record) != record.size() || !log.flush())
+		qWarning() << "can not write journal" << logPath();
+}
+
+void Journal::saveCheckpoint(const QImage &image, quint64 checkpointSequence)
+{
+	QImage tagged = image;
+	tagged.setText("sequence", QString::number(checkpointSequence));
+	QSaveFile file(checkpointPath());
+	if (!file.open(QIODevice::WriteOnly) || !tagged.save(&file, "PNG") || !file.commit())
+	{
+		qWarning() << "can not write checkpoint" << checkpointPath();
+		return;
+	}
+
+	// records before the checkpoint are all written, and none after it yet
+	log.resize(HEADER_SIZE);
+	log.seek(HEADER_SIZE);
+}
+
+void Journal::merge(const QVector<Canvas::Temp> &temp)
+{
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out << qint32(temp.size());
+	for (const Canvas::Temp &t : temp)
+		out << qint32(t.x) << qint32(t.y) << t.color;
+	append(MERGE, payload);
+}
+
+void Journal::fill(const QVector<Canvas::Edge> &polygon, const Canvas::FillStyle &style, const QColor &borderColor, Canvas::FillRule rule, bool antialiased)
+{
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out << qint32(polygon.size());
+	for (const Canvas::Edge &e : polygon)
+		out << e.p1 << e.p2;
+	writeStyle(out, style);
+	out << borderColor << qint32(rule) << antialiased;
+	append(FILL, payload);
+}
+
+void Journal::floodFill(int x, int y, const QColor &color, const Canvas::FloodRule &rule, const Mask *clip)
+{
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out << qint32(x) << qint32(y) << color << qint32(rule.tolerance) << qint32(rule.mode) << rule.eightConnected << bool(clip);
+	if (clip)
+		writeMask(out, *clip);
+	append(FLOOD_FILL, payload);
+}
+
+void Journal::fillMask(const Mask &mask, const Canvas::FillStyle &style)
+{
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	writeMask(out, mask);
+	writeStyle(out, style);
+	append(FILL_MASK, payload);
+}
+
+void Journal::fillRect(const QRect &rect, const QColor &color)
+{
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out << rect << color;
+	append(FILL_RECT, payload);
+}
+
+void Journal::moveRect(const QRect &rect, int dx, int dy, const QColor &fillColor)
+{
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out << rect << qint32(dx) << qint32(dy) << fillColor;
+	append(MOVE_RECT, payload);
+}
+
+void Journal::pasteBlock(const Canvas::Block &block, int x, int y)
+{
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out << qint32(block.width) << qint32(block.height);
+	for (QRgb color : block.pixels)
+		out << quint32(color);
+	out << qint32(x) << qint32(y);
+	append(PASTE_BLOCK, payload);
+}
+
+void Journal::replay(Canvas *canvas, int type, const QByteArray &payload)
+{
+	QDataStream in(payload);
+	switch (type)
+	{
+	case MERGE:
+	{
+		qint32 count;
+		in >> count;
+		QVector<Canvas::Temp> temp;
+		for (int i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+		{
+			qint32 x, y;
+			QColor color;
+			in >> x >> y >> color;
+			temp.push_back(Canvas::Temp(x, y, color));
+		}
+		canvas->merge(temp);
+		break;
+	}
+	case FILL:
+	{
+		qint32 count, rule;
+		in >> count;
+		QVector<Canvas::Edge> polygon;
+		for (int i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+		{
+			QPoint p1, p2;
+			in >> p1 >> p2;
+			polygon.push_back(Canvas::Edge(p1, p2));
+		}
+		Canvas::FillStyle style = readStyle(in);
+		QColor borderColor;
+		bool antialiased;
+		in >> borderColor >> rule >> antialiased;
+		canvas->fill(polygon, style, borderColor, Canvas::FillRule(rule), antialiased);
+		break;
+	}
+	case FLOOD_FILL:
+	{
+		qint32 x, y, tolerance, mode;
+		QColor color;
+		bool eightConnected, clipped;
+		in >> x >> y >> color >> tolerance >> mode >> eightConnected >> clipped;
+		Mask clip = clipped ? readMask(in) : Mask();
+		canvas->floodFill(x, y, color, Canvas::FloodRule(tolerance, Canvas::ToleranceMode(mode), eightConnected), clipped ? &clip : 0);
+		break;
+	}
+	case FILL_MASK:
+	{
+		Mask mask = readMask(in);
+		canvas->fillMask(mask, readStyle(in));
+		break;
+	}
+	case FILL_RECT:
+	{
+		QRect rect;
+		QColor color;
+		in >> rect >> color;
+		canvas->fillRect(rect, color);
+		break;
+	}
+	case MOVE_RECT:
+	{
+		QRect rect;
+		qint32 dx, dy;
+		QColor fillColor;
+		in >> rect >> dx >> dy >> fillColor;
+		canvas->moveRect(rect, dx, dy, fillColor);
+		break;
+	}
+	case PASTE_BLOCK:
+	{
+		qint32 width, height, x, y;
+		in >> width >> height;
+		if (width < 0 || height < 0 || qint64(width) * height * 4 > payload.size())
+			break;
+		Canvas::Block block(width, height);
+		for (QRgb &color : block.pixels)
+		{
+			quint32 value;
+			in >> value;
+			color = value;
+		}
+		in >> x >> y;
+		canvas->pasteBlock(block, x, y);
+		break;
+	}
+	default:
+		qWarning() << "unknown journal record" << type;
+		break;
+	}
+}
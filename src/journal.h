@@ -0,0 +1,80 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QColor>
+#include <QFile>
+#include <QLockFile>
+#include <QImage>
+#include <QThreadPool>
+#include "canvas.h"
+#include "mask.h"
+
+// Append-only log of operations committed to a Canvas, to restore work after a crash.
+//
+// Records are serialized in the GUI thread and written in order by one writer
+// thread. checkpoint() takes a snapshot of the canvas, the writer saves it as PNG
+// and truncates the log, so open() only replays the operations after it.
+// The files are locked by the instance that opened them, other instances run
+// without a journal, so they never replay or remove each other's work.
+//
+// Log format, integers are big endian:
+//   header: magic "MPJN", version
+//   record: payload size (quint32), sequence (quint64), type (quint8), payload, CRC-16 of the rest
+// A torn record at the end is dropped.
+class Journal
+{
+public:
+	Journal(const QString &directory);
+	~Journal(); // wait for the writer
+
+	bool open(Canvas *canvas); // load checkpoint and replay the log into canvas, then append to the log. return false if nothing is restored or the journal is locked
+	void checkpoint(const Canvas *canvas); // skipped if nothing is recorded since the last one
+	void discard(); // remove log and checkpoint after a clean exit, if this instance holds the lock
+
+	// same arguments as the Canvas operations, call them with the canvas in the state before the operation
+	void merge(const QVector<Canvas::Temp> &temp);
+	void fill(const QVector<Canvas::Edge> &polygon, const Canvas::FillStyle &style, const QColor &borderColor, Canvas::FillRule rule, bool antialiased);
+	void floodFill(int x, int y, const QColor &color, const Canvas::FloodRule &rule, const Mask *clip);
+	void fillMask(const Mask &mask, const Canvas::FillStyle &style);
+	void fillRect(const QRect &rect, const QColor &color);
+	void moveRect(const QRect &rect, int dx, int dy, const QColor &fillColor);
+	void pasteBlock(const Canvas::Block &block, int x, int y);
+
+private:
+	const quint32 MAGIC = 0x4d504a4e; // "MPJN"
+	const quint32 VERSION = 4; // 2: hatch fill styles, 3: blocks of QRgb, 4: anti-aliased fills
+	const int HEADER_SIZE = 8;
+	const int RECORD_HEAD = 13; // size, sequence and type
+	const int RECORD_TAIL = 2;	// checksum
+
+	enum Type
+	{
+		MERGE,
+		FILL,
+		FLOOD_FILL,
+		FILL_MASK,
+		FILL_RECT,
+		MOVE_RECT,
+		PASTE_BLOCK
+	};
+
+	QString directory;
+	QLockFile lock; // held from open() to discard()
+	QThreadPool writer; // one thread, so records are written in order
+	QFile log;					// used by the writer after open()
+	bool opened = false;
+	quint64 sequence = 0;			// of the next record
+	quint64 checkpointed = 0; // sequence of the last checkpoint
+
+	QString logPath() const;
+	QString checkpointPath() const;
+	void append(Type type, const QByteArray &payload);
+	void write(const QByteArray &record);													 // writer thread
+	void saveCheckpoint(const QImage &image, quint64 checkpointSequence); // writer thread
+	static void replay(Canvas *canvas, int type, const QByteArray &payload);
+};
+
+#endif // JOURNAL_H
@@ -1,8 +1,18 @@
 #include "mainwindow.h"
+#include "batchrenderer.h"
 #include <QApplication>
+#include <QCoreApplication>
+#include <QByteArray>
 
 int main(int argc, char *argv[])
 {
+	// render command streams without a window
+	if (argc > 1 && qstrcmp(argv[1], "--batch") == 0)
+	{
+		QCoreApplication a(argc, argv);
+		return BatchRenderer::main(a.arguments());
+	}
+
 	QApplication a(argc, argv);
 	MainWindow w;
 	w.show();
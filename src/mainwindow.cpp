@@ -35,6 +35,12 @@ MainWindow::Tool MainWindow::getTool() const
 		return ELLIPSE;
 	else if (ui->floodBtn->isChecked())
 		return FLOOD;
+	else if (ui->bezierBtn->isChecked())
+		return BEZIER;
+	else if (ui->wandBtn->isChecked())
+		return WAND;
+	else if (ui->selectBtn->isChecked())
+		return SELECT;
 	else
 		return POLYGON;
 }
@@ -45,6 +51,10 @@ MainWindow::PolyFillType MainWindow::getPolyFillType() const
 		return SHADOW;
 	else if (ui->colorBtn->isChecked())
 		return COLOR;
+	else if (ui->linearBtn->isChecked())
+		return LINEAR;
+	else if (ui->radialBtn->isChecked())
+		return RADIAL;
 	else
 		return NO;
 }
@@ -24,13 +24,18 @@ public:
 		RECT,
 		ELLIPSE,
 		FLOOD,
-		POLYGON
+		POLYGON,
+		BEZIER,
+		WAND,
+		SELECT
 	};
 
 	enum PolyFillType
 	{
 		SHADOW,
 		COLOR,
+		LINEAR, // gradient from background color to foreground color
+		RADIAL,
 		NO
 	};
 
@@ -38,6 +43,14 @@ public:
 	Tool getTool() const;
 	PolyFillType getPolyFillType() const;
 	int getShadowInterval() const { return ui->intervalSb->value(); }
+	int getHatchAngle() const { return ui->angleSb->value(); }
+	int getHatchWidth() const { return ui->hatchWidthSb->value(); }
+	bool isCrossHatch() const { return ui->crossCb->isChecked(); }
+	bool isNonZeroFill() const { return ui->fillRuleCb->currentIndex() == 1; } // otherwise even-odd
+	int getTolerance() const { return ui->toleranceSb->value(); }
+	bool isDistanceTolerance() const { return ui->toleranceCb->currentIndex() == 1; } // otherwise per channel
+	bool isEightConnected() const { return ui->eightCb->isChecked(); }
+	bool isAntialiased() const { return ui->antialiasCb->isChecked(); }
 	QColor getFgColor() const { return *fgColor; }
 	QColor getBgColor() const { return *bgColor; }
 
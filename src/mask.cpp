@@ -0,0 +1,112 @@
+#include "mask.h"
+#include <QtAlgorithms>
+
+Mask::Mask(int width, int height) : WIDTH(width), HEIGHT(height)
+{
+	WORDS = (WIDTH + 63) / 64;
+	bits.fill(0, WORDS * HEIGHT);
+}
+
+void Mask::clear()
+{
+	bits.fill(0);
+	bounds = QRect();
+}
+
+void Mask::setSpan(int y, int x1, int x2)
+{
+	quint64 *r = row(y);
+	int w1 = x1 >> 6;
+	int w2 = x2 >> 6;
+	quint64 first = ~0ULL << (x1 & 63);
+	quint64 last = ~0ULL >> (63 - (x2 & 63));
+	if (w1 == w2)
+	{
+		r[w1] |= first & last;
+	}
+	else
+	{
+		r[w1] |= first;
+		for (int w = w1 + 1; w < w2; ++w)
+			r[w] = ~0ULL;
+		r[w2] |= last;
+	}
+	bounds = bounds.united(QRect(x1, y, x2 - x1 + 1, 1));
+}
+
+int Mask::nextSet(int y, int x) const
+{
+	if (x >= WIDTH)
+		return WIDTH;
+	const quint64 *r = row(y);
+	int w = x >> 6;
+	quint64 word = r[w] & (~0ULL << (x & 63));
+	while (!word)
+	{
+		if (++w == WORDS)
+			return WIDTH;
+		word = r[w];
+	}
+	return qMin(WIDTH, w * 64 + int(qCountTrailingZeroBits(word)));
+}
+
+int Mask::nextClear(int y, int x) const
+{
+	if (x >= WIDTH)
+		return WIDTH;
+	const quint64 *r = row(y);
+	int w = x >> 6;
+	quint64 word = ~r[w] & (~0ULL << (x & 63));
+	while (!word)
+	{
+		if (++w == WORDS)
+			return WIDTH;
+		word = ~r[w];
+	}
+	// bits after WIDTH are never set, so they count as clear
+	return qMin(WIDTH, w * 64 + int(qCountTrailingZeroBits(word)));
+}
+
+int Mask::prevClear(int y, int x) const
+{
+	if (x < 0)
+		return -1;
+	const quint64 *r = row(y);
+	int w = x >> 6;
+	quint64 word = ~r[w] & (~0ULL >> (63 - (x & 63)));
+	while (!word)
+	{
+		if (--w < 0)
+			return -1;
+		word = ~r[w];
+	}
+	return w * 64 + 63 - int(qCountLeadingZeroBits(word));
+}
+
+Mask Mask::border() const
+{
+	Mask result(WIDTH, HEIGHT);
+	if (isEmpty())
+		return result;
+
+	// a pixel is inside if itself and its 4 neighbours are set
+	for (int y = bounds.top(); y <= bounds.bottom(); ++y)
+	{
+		const quint64 *current = row(y);
+		const quint64 *below = y > 0 ? row(y - 1) : 0;
+		const quint64 *above = y < HEIGHT - 1 ? row(y + 1) : 0;
+		quint64 *out = result.row(y);
+		for (int w = 0; w < WORDS; ++w)
+		{
+			quint64 word = current[w];
+			if (!word)
+				continue;
+			quint64 left = (word << 1) | (w > 0 ? current[w - 1] >> 63 : 0); // bit x means x - 1 is set
+			quint64 right = (word >> 1) | (w < WORDS - 1 ? current[w + 1] << 63 : 0); // bit x means x + 1 is set
+			quint64 inside = word & left & right & (below ? below[w] : 0) & (above ? above[w] : 0);
+			out[w] = word & ~inside;
+		}
+	}
+	result.bounds = bounds;
+	return result;
+}
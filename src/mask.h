@@ -0,0 +1,39 @@
+#ifndef MASK_H
+#define MASK_H
+
+#include <QVector>
+#include <QRect>
+#include <QtGlobal>
+
+// 1 bit per pixel, left bottom is (0, 0) like Canvas
+class Mask
+{
+public:
+	Mask(int width = 0, int height = 0);
+
+	int width() const { return WIDTH; }
+	int height() const { return HEIGHT; }
+	bool isEmpty() const { return bounds.isEmpty(); }
+	QRect boundingRect() const { return bounds; } // of set pixels, only grows
+	void clear();
+
+	bool test(int x, int y) const { return (bits[y * WORDS + (x >> 6)] >> (x & 63)) & 1; }
+	void setSpan(int y, int x1, int x2); // x1 <= x2, both are inside
+	quint64 *row(int y) { return bits.data() + y * WORDS; }
+	const quint64 *row(int y) const { return bits.constData() + y * WORDS; }
+
+	int nextSet(int y, int x) const; // first set pixel >= x, or width
+	int nextClear(int y, int x) const; // first clear pixel >= x, or width
+	int prevClear(int y, int x) const; // last clear pixel <= x, or -1
+	Mask border() const; // set pixels with a 4-neighbour clear or out of mask
+
+private:
+	int WIDTH;
+	int HEIGHT;
+	int WORDS; // words of a row
+
+	QVector<quint64> bits;
+	QRect bounds;
+};
+
+#endif // MASK_H
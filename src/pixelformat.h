@@ -0,0 +1,215 @@
+#ifndef PIXELFORMAT_H
+#define PIXELFORMAT_H
+
+#include <QColor>
+#include <QtEndian>
+#include <cstring>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// pixel format policies of BasicCanvas
+// a policy packs a row of pixels into bytes and converts its Pixel from and to QRgb,
+// kernels work on Pixel and convert only when colors come in or pixels are blitted
+
+// pixels of a whole number of bytes, stored as T
+template <typename T>
+struct WordFormat
+{
+	typedef T Pixel;
+	static int bytesPerLine(int width) { return width * int(sizeof(T)); }
+	static Pixel load(const uchar *line, int x) { return reinterpret_cast<const T *>(line)[x]; }
+	static void store(uchar *line, int x, Pixel p) { reinterpret_cast<T *>(line)[x] = p; }
+	static void fillSpan(uchar *line, int x1, int x2, Pixel p) // x1 <= x2
+	{
+		T *pixels = reinterpret_cast<T *>(line);
+		std::fill(pixels + x1, pixels + x2 + 1, p);
+	}
+	static void maskSpan(uchar *line, int x1, int x2, const quint8 *mask, Pixel p) // x1 <= x2, pixel x gets p if mask[x - x1] is set
+	{
+		T *pixels = reinterpret_cast<T *>(line) + x1;
+		int count = x2 - x1 + 1;
+		int i = 0;
+#ifdef __SSE2__
+		// a vector of pixels at a time, the mask bytes widened to the pixel size select p or the old pixel
+		const int step = 16 / int(sizeof(T));
+		__m128i color = sizeof(T) == 4 ? _mm_set1_epi32(int(p)) : (sizeof(T) == 2 ? _mm_set1_epi16(short(p)) : _mm_set1_epi8(char(p)));
+		__m128i zero = _mm_setzero_si128();
+		for (; i + step <= count; i += step)
+		{
+			__m128i m;
+			if (sizeof(T) == 1)
+			{
+				m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mask + i));
+			}
+			else if (sizeof(T) == 2)
+			{
+				m = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(mask + i));
+			}
+			else
+			{
+				int four;
+				memcpy(&four, mask + i, 4);
+				m = _mm_cvtsi32_si128(four);
+			}
+			m = _mm_cmpeq_epi8(m, zero); // all ones where the old pixel stays
+			if (sizeof(T) >= 2)
+				m = _mm_unpacklo_epi8(m, m);
+			if (sizeof(T) == 4)
+				m = _mm_unpacklo_epi16(m, m);
+			__m128i *at = reinterpret_cast<__m128i *>(pixels + i);
+			_mm_storeu_si128(at, _mm_or_si128(_mm_and_si128(m, _mm_loadu_si128(at)), _mm_andnot_si128(m, color)));
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			if (mask[i])
+				pixels[i] = p;
+		}
+	}
+	static void copySpan(const uchar *from, int fromX, uchar *to, int toX, int count) // overlap-safe
+	{
+		memmove(to + toX * sizeof(T), from + fromX * sizeof(T), count * sizeof(T));
+	}
+};
+
+struct Argb32 : WordFormat<quint32>
+{
+	static Pixel fromRgb(QRgb rgb) { return rgb; }
+	static QRgb toRgb(Pixel p) { return p; }
+	static void toRgb(const uchar *line, int x1, int x2, QRgb *out) // same layout, a plain copy
+	{
+		memcpy(out, line + x1 * sizeof(Pixel), (x2 - x1 + 1) * sizeof(Pixel));
+	}
+};
+
+struct Rgb565 : WordFormat<quint16>
+{
+	static Pixel fromRgb(QRgb rgb) { return Pixel(((qRed(rgb) >> 3) << 11) | ((qGreen(rgb) >> 2) << 5) | (qBlue(rgb) >> 3)); }
+	static QRgb toRgb(Pixel p)
+	{
+		// replicate high bits into the low ones, so white stays white
+		int r = (p >> 11) & 0x1f;
+		int g = (p >> 5) & 0x3f;
+		int b = p & 0x1f;
+		return qRgb((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+	}
+	static void toRgb(const uchar *line, int x1, int x2, QRgb *out)
+	{
+		const Pixel *pixels = reinterpret_cast<const Pixel *>(line);
+		for (int x = x1; x <= x2; ++x)
+			*out++ = toRgb(pixels[x]);
+	}
+};
+
+// fixed palette: 6x6x6 color cube, then 40 grays
+struct Indexed8 : WordFormat<quint8>
+{
+	static Pixel fromRgb(QRgb rgb)
+	{
+		// nearest of the cube color and the gray
+		int r = qRed(rgb), g = qGreen(rgb), b = qBlue(rgb);
+		int ri = (r * 5 + 127) / 255, gi = (g * 5 + 127) / 255, bi = (b * 5 + 127) / 255;
+		int cubeError = square(r - ri * 51) + square(g - gi * 51) + square(b - bi * 51);
+		int level = ((r + g + b) * 39 + 382) / 765;
+		int gray = level * 255 / 39;
+		int grayError = square(r - gray) + square(g - gray) + square(b - gray);
+		if (grayError < cubeError)
+			return Pixel(216 + level);
+		return Pixel(ri * 36 + gi * 6 + bi);
+	}
+	static QRgb toRgb(Pixel p)
+	{
+		if (p >= 216)
+		{
+			int gray = (p - 216) * 255 / 39;
+			return qRgb(gray, gray, gray);
+		}
+		return qRgb(p / 36 * 51, p / 6 % 6 * 51, p % 6 * 51);
+	}
+	static void toRgb(const uchar *line, int x1, int x2, QRgb *out)
+	{
+		for (int x = x1; x <= x2; ++x)
+			*out++ = toRgb(line[x]);
+	}
+
+private:
+	static int square(int a) { return a * a; }
+};
+
+// 1 bit per pixel, most significant bit first like QImage::Format_Mono, 1 is white
+struct Mono1
+{
+	typedef quint8 Pixel;
+	static int bytesPerLine(int width) { return (width + 7) / 8; }
+	static Pixel fromRgb(QRgb rgb) { return qGray(rgb) >= 128; }
+	static QRgb toRgb(Pixel p) { return p ? qRgb(255, 255, 255) : qRgb(0, 0, 0); }
+	static Pixel load(const uchar *line, int x) { return (line[x >> 3] >> (7 - (x & 7))) & 1; }
+	static void store(uchar *line, int x, Pixel p)
+	{
+		uchar bit = uchar(0x80 >> (x & 7));
+		if (p)
+			line[x >> 3] |= bit;
+		else
+			line[x >> 3] &= uchar(~bit);
+	}
+	static void fillSpan(uchar *line, int x1, int x2, Pixel p)
+	{
+		// partial bytes at both ends, whole bytes between
+		int first = x1 >> 3, last = x2 >> 3;
+		uchar head = uchar(0xff >> (x1 & 7));
+		uchar tail = uchar(0xff << (7 - (x2 & 7)));
+		if (first == last)
+			head &= tail;
+		line[first] = p ? (line[first] | head) : (line[first] & ~head);
+		if (first == last)
+			return;
+		if (last - first > 1)
+			memset(line + first + 1, p ? 0xff : 0, last - first - 1);
+		line[last] = p ? (line[last] | tail) : (line[last] & ~tail);
+	}
+	static void maskSpan(uchar *line, int x1, int x2, const quint8 *mask, Pixel p) // mask bytes are 0 or 1
+	{
+		// bit by bit up to a whole byte, then 8 mask bytes are packed into a byte of bits and or-ed in
+		int x = x1;
+		for (; x <= x2 && (x & 7); ++x)
+		{
+			if (mask[x - x1])
+				store(line, x, p);
+		}
+		for (; x + 7 <= x2; x += 8)
+		{
+			// mask byte i moves to bit 7 - i of the top byte, no two products overlap so nothing carries
+			quint64 eight = qFromLittleEndian<quint64>(mask + (x - x1));
+			uchar bits = uchar((eight * Q_UINT64_C(0x8040201008040201)) >> 56);
+			line[x >> 3] = p ? (line[x >> 3] | bits) : (line[x >> 3] & ~bits);
+		}
+		for (; x <= x2; ++x)
+		{
+			if (mask[x - x1])
+				store(line, x, p);
+		}
+	}
+	static void copySpan(const uchar *from, int fromX, uchar *to, int toX, int count)
+	{
+		// bit by bit, backwards if to is right of from in the same row
+		if (from == to && toX > fromX)
+		{
+			for (int i = count - 1; i >= 0; --i)
+				store(to, toX + i, load(from, fromX + i));
+		}
+		else
+		{
+			for (int i = 0; i < count; ++i)
+				store(to, toX + i, load(from, fromX + i));
+		}
+	}
+	static void toRgb(const uchar *line, int x1, int x2, QRgb *out)
+	{
+		for (int x = x1; x <= x2; ++x)
+			*out++ = toRgb(load(line, x));
+	}
+};
+
+#endif // PIXELFORMAT_H
@@ -6,6 +6,9 @@
 #include <QPoint>
 #include <QtAlgorithms>
 #include <QtMath>
+#include <QtConcurrent>
+#include <QStandardPaths>
+#include <algorithm>
 
 Scene::Scene(MainWindow *parent) : QWidget(parent)
 {
@@ -14,559 +17,749 @@ Scene::Scene(MainWindow *parent) : QWidget(parent)
 	setFixedSize(WIDTH, HEIGHT);
 
 	// init pixels
-	permanent = new QColor *[HEIGHT];
-	for (int i = 0; i < HEIGHT; ++i)
-	{
-		permanent[i] = new QColor[WIDTH];
-		for (int j = 0; j < WIDTH; ++j)
-		{
-			permanent[i][j] = QColor(255, 255, 255); // white
-		}
-	}
+	canvas = new Canvas(WIDTH, HEIGHT);
 
 	// init cache
-	cache = new QPixmap(WIDTH, HEIGHT);
-	cache->fill(); // fill with white color
+	cache = new QImage(WIDTH, HEIGHT, QImage::Format_RGB32);
+	cache->fill(Qt::white);
+
+	// restore work left by a crash
+	journal = new Journal(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+	if (journal->open(canvas))
+		refreshingPermanent = true; // compose the whole canvas in the first paint
+	startTimer(CHECKPOINT_INTERVAL);
+
+	// init outline diff
+	stamp.fill(0, WIDTH * HEIGHT);
+	owner.fill(0, WIDTH * HEIGHT);
+	placedAt.fill(-1, WIDTH * HEIGHT);
+
+	// init selection
+	selection = Mask(WIDTH, HEIGHT);
+	selectionBorder = Mask(WIDTH, HEIGHT);
 
 	setAttribute(Qt::WA_OpaquePaintEvent); // enable paint without erase
+	setFocusPolicy(Qt::ClickFocus);				 // for selection keys
 
 	repaint(); // draw background
 }
 
 Scene::~Scene()
 {
-	for (int i = 0; i < HEIGHT; ++i)
-	{
-		delete[] permanent[i];
-	}
-	delete[] permanent;
+	// nothing to restore after a clean exit
+	journal->discard();
+	delete journal;
+	delete canvas;
+	delete cache;
 }
 
 void Scene::done()
 {
 	// merge temp to permanent
-	for (int i = 0; i < temp.size(); ++i)
+	if (temp.size())
+		journal->merge(temp);
+	canvas->merge(temp);
+	temp.clear(); // already on screen
+
+	// floating pixels are on screen too, drop them into permanent by rows
+	if (floatingSelection)
 	{
-		// judge whether current point is inside canvas
-		if (temp[i].x >= 0 && temp[i].x < WIDTH && temp[i].y >= 0 && temp[i].y < HEIGHT)
-			permanent[temp[i].y][temp[i].x] = temp[i].color;
+		if (floatingSource.isValid())
+		{
+			int dx = floatingTarget.left() - floatingSource.left();
+			int dy = floatingTarget.top() - floatingSource.top();
+			journal->moveRect(floatingSource, dx, dy, floatingFillColor);
+			canvas->moveRect(floatingSource, dx, dy, floatingFillColor);
+		}
+		else
+		{
+			journal->pasteBlock(floating, floatingTarget.left(), floatingTarget.top());
+			canvas->pasteBlock(floating, floatingTarget.left(), floatingTarget.top());
+		}
+		floatingSelection = false;
+		floating = Canvas::Block();
+		setSelectionRect(floatingTarget);
 	}
-	temp.clear();
-
-	// drawingTemp and clearingTemp should always be false
-	// just in case
-	drawingTemp = false;
-	clearingTemp = false;
 }
 
 void Scene::drawLine(int x, int y)
 {
-	clearTemp();
+	QVector<Temp> previous;
+	previous.swap(temp);
 
 	endX = x;
 	endY = y;
 
 	getLine(startX, startY, x, y);
+	joinPlaced();
+
+	updateTemp(previous);
+}
 
-	drawTemp();
+void Scene::getLine(int x1, int y1, int x2, int y2)
+{
+	if (window->isAntialiased())
+		canvas->getSmoothLine(x1, y1, x2, y2, window->getFgColor(), temp);
+	else
+		canvas->getLine(x1, y1, x2, y2, window->getFgColor(), temp);
 }
 
-void Scene::BresenhamLine(int x1, int y1, int x2, int y2)
+void Scene::drawRect(int x, int y)
 {
-	// check x1, y1, x2, y2
-	if (x1 > x2)
+	QVector<Temp> previous;
+	previous.swap(temp);
+
+	endX = x;
+	endY = y;
+
+	// draw rect border
+	canvas->getRect(startX, startY, endX, endY, window->getFgColor(), temp);
+
+	updateTemp(previous);
+}
+
+void Scene::floodFill(int x, int y)
+{
+	QRect changed;
+	const Mask *clip = selection.isEmpty() ? 0 : &selection;
+	if (window->getPolyFillType() == MainWindow::LINEAR || window->getPolyFillType() == MainWindow::RADIAL)
 	{
-		qDebug() << "bad x";
-		return;
+		// gradient spans the region
+		Mask region = canvas->selectRegion(x, y, floodRule(), clip);
+		Canvas::FillStyle style = fillStyle(region.boundingRect());
+		journal->fillMask(region, style);
+		changed = canvas->fillMask(region, style);
 	}
-	if (y1 > y2)
+	else
 	{
-		qDebug() << "bad y";
-		return;
+		journal->floodFill(x, y, window->getFgColor(), floodRule(), clip);
+		changed = canvas->floodFill(x, y, window->getFgColor(), floodRule(), clip);
 	}
-	if (abs(x1 - x2) < abs(y1 - y2))
+	if (changed.isValid())
 	{
-		qDebug() << "bad scale";
-		return;
+		refreshingPermanent = true;
+		repaint(changed.left(), transformY(changed.bottom()), changed.width(), changed.height());
 	}
+}
 
-	temp.clear();
-	int e = -(x2 - x1);
-	int currentY = y1;
-	for (int i = x1; i <= x2; ++i)
-	{
-		if (e >= 0)
-		{
-			e -= 2 * (x2 - x1);
-			++currentY;
-		}
-		e += 2 * (y2 - y1);
-		temp.push_back(Temp(i, currentY, window->getFgColor())); // temp[i - x1]
-	}
+void Scene::select(int x, int y)
+{
+	clearSelection();
+	selection = canvas->selectRegion(x, y, floodRule());
+	selectionBorder = selection.border();
+	repaintSelection();
 }
 
-void Scene::getLine(int x1, int y1, int x2, int y2)
+void Scene::clearSelection()
 {
-	if (x1 <= x2)
-	{
-		if (y1 <= y2)
-		{
-			if (abs(x1 - x2) >= abs(y1 - y2))
-			{
-				// 0 <= gradient <= 1
-				BresenhamLine(x1, y1, x2, y2);
-			}
-			else
-			{
-				// 1 < gradient < infinite
-				BresenhamLine(y1, x1, y2, x2);
-				swapTemp();
-			}
-		}
-		else
-		{
-			if (abs(x1 - x2) >= abs(y1 - y2))
-			{
-				// -1 <= gradient < 0
-				BresenhamLine(x1, y1, x2, 2 * y1 - y2);
-				flipY(y1);
-			}
-			else
-			{
-				// -infinite < gradient < -1
-				BresenhamLine(y1, x1, 2 * y1 - y2, x2);
-				swapTemp();
-				flipY(y1);
-			}
-		}
-	}
-	else
+	selectionRect = QRect();
+	if (selection.isEmpty())
+		return;
+	Mask border = selectionBorder;
+	selection = Mask(WIDTH, HEIGHT);
+	selectionBorder = Mask(WIDTH, HEIGHT);
+
+	// restore pixels under the old border
+	QRect bounds = border.boundingRect();
+	for (int y = bounds.top(); y <= bounds.bottom(); ++y)
 	{
-		// exchange start and end
-		if (y2 <= y1)
-		{
-			if (abs(x2 - x1) >= abs(y2 - y1))
-			{
-				// 0 <= gradient <= 1
-				BresenhamLine(x2, y2, x1, y1);
-			}
-			else
-			{
-				// 1 < gradient < infinite
-				BresenhamLine(y2, x2, y1, x1);
-				swapTemp();
-			}
-		}
-		else
-		{
-			if (abs(x2 - x1) >= abs(y2 - y1))
-			{
-				// -1 <= gradient < 0
-				BresenhamLine(x2, y2, x1, 2 * y2 - y1);
-				flipY(y2);
-			}
-			else
-			{
-				// -infinite < gradient < -1
-				BresenhamLine(y2, x2, 2 * y2 - y1, x1);
-				swapTemp();
-				flipY(y2);
-			}
-		}
+		for (int x = border.nextSet(y, bounds.left()); x <= bounds.right(); x = border.nextSet(y, x + 1))
+			pending.push_back(Temp(x, y, canvas->pixel(x, y)));
 	}
+	repaintPending();
 }
 
-void Scene::drawRect(int x, int y)
+void Scene::drawSelectionRect(int x, int y)
 {
-	clearTemp();
+	QVector<Temp> previous;
+	previous.swap(temp);
 
 	endX = x;
 	endY = y;
 
-	// draw rect border
-	for (int i = min(x, startX); i <= max(x, startX); ++i)
+	canvas->getRect(startX, startY, endX, endY, QColor(), temp);
+	for (Temp &t : temp)
+		t.color = antColor(t.x, t.y);
+
+	updateTemp(previous);
+}
+
+void Scene::setSelectionRect(const QRect &rect)
+{
+	clearSelection();
+	QRect r = rect.intersected(QRect(0, 0, WIDTH, HEIGHT));
+	if (r.isEmpty())
+		return;
+	for (int y = r.top(); y <= r.bottom(); ++y)
+		selection.setSpan(y, r.left(), r.right());
+	selectionBorder = selection.border();
+	selectionRect = r;
+	repaintSelection();
+}
+
+void Scene::liftSelection(const Canvas::Block &block)
+{
+	QRect rect = selectionRect;
+	clearSelection();
+
+	floatingSelection = true;
+	floatingFillColor = window->getBgColor();
+	if (block.isEmpty())
 	{
-		temp.push_back(Temp(i, startY, window->getFgColor()));
-		temp.push_back(Temp(i, endY, window->getFgColor()));
+		// move canvas pixels, nothing is copied until done()
+		floating = Canvas::Block();
+		floatingSource = rect;
+		floatingTarget = rect;
 	}
-	for (int i = min(y, startY); i <= max(y, startY); ++i)
+	else
 	{
-		temp.push_back(Temp(startX, i, window->getFgColor()));
-		temp.push_back(Temp(x, i, window->getFgColor()));
+		// paste over the selection, or at left top
+		floating = block;
+		floatingSource = QRect();
+		floatingTarget = QRect(rect.isValid() ? rect.left() : 0, rect.isValid() ? rect.top() : HEIGHT - block.height, block.width, block.height);
 	}
+	refreshingPermanent = true;
+	repaint(transformRect(floatingTarget.united(floatingSource)));
+}
 
-	drawTemp();
+void Scene::moveFloating(int dx, int dy)
+{
+	QRect old = floatingTarget;
+	floatingTarget.moveTo(dragOrigin + QPoint(dx, dy));
+	refreshingPermanent = true;
+	repaint(transformRect(old.united(floatingTarget)));
 }
 
-void Scene::floodFill(int x, int y)
+void Scene::dropFloating(bool keepSource)
 {
-	if (rect().contains(x, transformY(y)))
+	if (!keepSource && floatingSource.isValid())
 	{
-		QColor baseColor = permanent[y][x];
-		if (baseColor == window->getFgColor())
-			return;
-		QVector<QPoint> openTable;
-		openTable.push_back(QPoint(x, y));
-		QPainter cachePainter(cache);
-		cachePainter.setPen(window->getFgColor());
-		int left = WIDTH;
-		int right = 0;
-		int top = 0;
-		int bottom = HEIGHT;
-		while (openTable.size())
-		{
-			auto p = openTable[0];
-			openTable.pop_front();
-			if (permanent[p.y()][p.x()] == baseColor)
-			{
-				permanent[p.y()][p.x()] = window->getFgColor();
-				cachePainter.drawPoint(p.x(), transformY(p.y()));
-				// judge border
-				if (p.x() < left)
-					left = p.x();
-				if (p.x() > right)
-					right = p.x();
-				if (p.y() > top)
-					top = p.y();
-				if (p.y() < bottom)
-					bottom = p.y();
-				// expand
-				if (rect().contains(p.x() + 1, transformY(p.y())))
-					openTable.push_back(QPoint(p.x() + 1, p.y()));
-				if (rect().contains(p.x() - 1, transformY(p.y())))
-					openTable.push_back(QPoint(p.x() - 1, p.y()));
-				if (rect().contains(p.x(), transformY(p.y() + 1)))
-					openTable.push_back(QPoint(p.x(), p.y() + 1));
-				if (rect().contains(p.x(), transformY(p.y() - 1)))
-					openTable.push_back(QPoint(p.x(), p.y() - 1));
-			}
-		}
-		cachePainter.end();
-		repaint(left, transformY(top), right - left + 1, top - bottom + 1);
+		journal->fillRect(floatingSource, floatingFillColor);
+		canvas->fillRect(floatingSource, floatingFillColor);
 	}
+	floatingSelection = false;
+	floating = Canvas::Block();
+	refreshingPermanent = true;
+	repaint(transformRect(floatingTarget.united(floatingSource)));
 }
 
-void Scene::fill(int step)
+void Scene::floatingLine(int y, int x1, int x2, QRgb *out) const
 {
-	auto ET = constructET();
-
-	// AEL just store a Node vector
-	QVector<Node> AEL;
-	int currentY;
-	while (AEL.size() || ET.size())
+	int dx = x1 - floatingTarget.left();
+	int dy = y - floatingTarget.top();
+	if (floatingSource.isValid())
 	{
-		if (!AEL.size())
-		{
-			// AEL is empty, move ET.first() to AEL
-			AEL = ET.first();
-			currentY = ET.firstKey();
-			ET.remove(ET.firstKey());
-			++currentY;
-		}
-		else
-		{
-			if (ET.size() && ET.firstKey() == currentY)
-			{
-				// merge ET.first() to AEL
-				AEL.append(ET.first());
-				std::sort(AEL.begin(), AEL.end());
-
-				// remove ET.first()
-				ET.remove(ET.firstKey());
-			}
-
-			// draw
-			if (currentY >= 0 && currentY < HEIGHT && (step == 0 || currentY % (step + 1) == 0))
-			{
-				auto AEL_copy = AEL;
-				// process extreme singularity points
-				QVector<int> reachBorder; // -1 means lower border, 1 means upper border, 0 means normal
-				for (int i = 0; i < AEL_copy.size(); ++i)
-				{
-					if (edges[AEL_copy[i].edgeIndex].upperPoint.y() == currentY)
-					{
-						reachBorder.push_back(1);
-					}
-					else if (edges[AEL_copy[i].edgeIndex].lowerPoint.y() == currentY)
-					{
-						reachBorder.push_back(-1);
-					}
-					else
-					{
-						reachBorder.push_back(0);
-					}
-				}
-				bool flag = true; // means still processing extreme singularity points
-				while (flag)
-				{
-					flag = false;
-					for (int i = 0; i < reachBorder.size() - 1; ++i)
-					{
-						if (reachBorder[i] * reachBorder[i + 1] == -1)
-						{
-							if (reachBorder[i] == -1)
-								++i; // i = i + 1, remove the lower edge
-							reachBorder.remove(i);
-							AEL_copy.remove(i);
-							flag = true; // continue loop
-							break;
-						}
-					}
-				}
-
-				while (AEL_copy.size())
-				{
-					// draw line according to the first 2 items in AEL
-					for (int i = max(0, AEL_copy[0].x); i <= min(WIDTH - 1, AEL_copy[1].x); ++i)
-					{
-						permanent[currentY][i] = window->getBgColor();
-					}
-					// remove the first 2 items in AEL
-					AEL_copy.pop_front();
-					AEL_copy.pop_front();
-				}
-			}
-			else if (currentY < 0 || currentY >= HEIGHT) // overflow
-			{
-				break;
-			}
-
-			// strip AEL
-			for (int i = 0; i < AEL.size(); ++i)
-			{
-				if (AEL[i].yMax == currentY)
-				{
-					AEL.remove(i);
-					--i;
-				}
-			}
-
-			// get next x
-			for (auto &node : AEL)
-			{
-				node.x += node.deltaX;
-			}
-			// sort AEL
-			std::sort(AEL.begin(), AEL.end());
+		canvas->readLine(floatingSource.top() + dy, floatingSource.left() + dx, floatingSource.left() + dx + x2 - x1, out);
+		return;
+	}
+	const QRgb *source = floating.scanLine(dy) + dx;
+	std::copy(source, source + x2 - x1 + 1, out);
+}
 
-			++currentY;
-		}
+void Scene::eraseSelection()
+{
+	if (floatingSelection)
+	{
+		dropFloating(false);
 	}
+	else if (!selection.isEmpty())
+	{
+		// the border is kept
+		journal->fillMask(selection, window->getBgColor());
+		QRect changed = canvas->fillMask(selection, window->getBgColor());
+		refreshingPermanent = true;
+		repaint(transformRect(changed));
+	}
+}
 
-	// repaint border
-	for (int i = 0; i < edges.size(); ++i)
+Canvas::FillStyle Scene::fillStyle(const QRect &bounds) const
+{
+	switch (window->getPolyFillType())
 	{
-		startX = edges[i].p1.x();
-		startY = edges[i].p1.y();
-		drawLine(edges[i].p2.x(), edges[i].p2.y());
-		done();
+	case MainWindow::LINEAR:
+		return Canvas::FillStyle::linear(window->getBgColor(), window->getFgColor(), bounds);
+	case MainWindow::RADIAL:
+		return Canvas::FillStyle::radial(window->getBgColor(), window->getFgColor(), bounds);
+	case MainWindow::SHADOW:
+		return Canvas::FillStyle::hatch(window->getBgColor(), window->getShadowInterval(), window->getHatchAngle(), window->getHatchWidth(), window->isCrossHatch());
+	default:
+		return Canvas::FillStyle(window->getBgColor());
 	}
+}
+
+Canvas::FloodRule Scene::floodRule() const
+{
+	return Canvas::FloodRule(window->getTolerance(), window->isDistanceTolerance() ? Canvas::DISTANCE : Canvas::CHANNEL, window->isEightConnected());
+}
+
+void Scene::fill()
+{
+	Canvas::FillStyle style = fillStyle(Canvas::boundingRect(edges));
+	Canvas::FillRule rule = window->isNonZeroFill() ? Canvas::NON_ZERO : Canvas::EVEN_ODD;
+	journal->fill(edges, style, window->getFgColor(), rule, window->isAntialiased());
+	canvas->fill(edges, style, window->getFgColor(), rule, window->isAntialiased());
 
 	refreshingPermanent = true;
 	repaint();
 }
 
-QMap<int, QVector<Scene::Node>> Scene::constructET()
+void Scene::finishShape()
+{
+	// fill() draws the border over the fill, merging the outline first would blend its edge pixels twice
+	bool filled = window->getPolyFillType() != MainWindow::NO;
+	if (filled)
+		clearTemp();
+	done();
+	if (filled)
+		fill();
+}
+
+void Scene::joinPlaced()
 {
-	QMap<int, QVector<Node>> ET;
-	for (int i = 0; i < edges.size(); ++i)
+	// only the pixels near the last vertex meet placed ones, as joinCoverage would join them
+	if (placed.isEmpty() || !window->isAntialiased())
+		return;
+	for (Temp &t : temp)
 	{
-		// ignore horizontal edge
-		if (edges[i].p1.y() == edges[i].p2.y())
+		if (!canvas->contains(t.x, t.y))
 			continue;
+		int at = placedAt[t.y * WIDTH + t.x];
+		if (at >= 0 && placed[at].color.alpha() > t.color.alpha())
+			t.color = placed[at].color;
+	}
+}
 
-		// judge upperPoint & lowerPoint
-		QPoint lowerPoint = (edges[i].p1.y() <= edges[i].p2.y()) ? edges[i].p1 : edges[i].p2;
-		QPoint upperPoint = (edges[i].p1.y() <= edges[i].p2.y()) ? edges[i].p2 : edges[i].p1;
-		edges[i].lowerPoint = lowerPoint;
-		edges[i].upperPoint = upperPoint;
-
-		// construct new Node
-		Node node;
-		node.yMax = upperPoint.y();
-		node.x = lowerPoint.x();
-		node.deltaX = (double)(lowerPoint.x() - upperPoint.x()) / (double)(lowerPoint.y() - upperPoint.y());
-		node.edgeIndex = i;
-
-		// link
-		if (ET.contains(lowerPoint.y()))
+void Scene::place()
+{
+	// the rubber band is joined already, its pixels replace placed ones at the same place
+	for (const Temp &t : temp)
+	{
+		if (!canvas->contains(t.x, t.y))
 		{
-			// ordered by x asc; if equal, ordered by deltaX
-			bool flag = true; // need to add to tail of ET
-			for (int i = 0; i < ET[lowerPoint.y()].size(); ++i)
-			{
-				if (ET[lowerPoint.y()][i].x == node.x)
-				{
-					if (ET[lowerPoint.y()][i].deltaX > node.deltaX)
-					{
-						ET[lowerPoint.y()].insert(i, node);
-						flag = false;
-						break;
-					}
-				}
-				else if (ET[lowerPoint.y()][i].x > node.x)
-				{
-					ET[lowerPoint.y()].insert(i, node);
-					flag = false;
-					break;
-				}
-			}
-			if (flag)
-			{
-				ET[lowerPoint.y()].push_back(node);
-			}
+			placed.push_back(t);
+			continue;
+		}
+		int &at = placedAt[t.y * WIDTH + t.x];
+		if (at >= 0)
+		{
+			placed[at] = t;
 		}
 		else
 		{
-			ET.insert(lowerPoint.y(), QVector<Node>());
-			ET[lowerPoint.y()].push_back(node);
+			at = placed.size();
+			placed.push_back(t);
 		}
 	}
-	return ET;
+	temp.clear(); // on screen already
+}
+
+void Scene::takePlaced()
+{
+	place();
+	for (const Temp &t : placed)
+	{
+		if (canvas->contains(t.x, t.y))
+			placedAt[t.y * WIDTH + t.x] = -1;
+	}
+	temp.swap(placed);
+}
+
+void Scene::dropPlaced()
+{
+	for (const Temp &t : placed)
+	{
+		if (!canvas->contains(t.x, t.y))
+			continue;
+		placedAt[t.y * WIDTH + t.x] = -1;
+		pending.push_back(Temp(t.x, t.y, displayColor(t.x, t.y)));
+	}
+	placed.clear();
+	repaintPending();
 }
 
 void Scene::drawEllipse(int x, int y)
 {
-	clearTemp();
+	QVector<Temp> previous;
+	previous.swap(temp);
 
 	endX = x;
 	endY = y;
 
-	// using Polygon Approximation Method, edges of polygon is 360
-	double a = abs(startX - endX) / 2;
-	double b = abs(startY - endY) / 2;
-	QPoint center = QPoint((x + startX) / 2, (y + startY) / 2);
-	int n = 360; // edges' number of polygon
-
-	edges.clear();
-	double sin = qSin(qDegreesToRadians(double(360 / n)));
-	double cos = qCos(qDegreesToRadians(double(360 / n)));
-	double currentX = a;
-	double currentY = 0;
-	for (int i = 0; i < n; ++i)
-	{
-		double nextX = currentX * cos - a / b * currentY * sin;
-		double nextY = currentY * cos + b / a * currentX * sin;
-		auto e = Edge(QPoint(currentX + center.x(), currentY + center.y()), QPoint(nextX + center.x(), nextY + center.y()));
-		if (e.p1 != e.p2)
-			edges.push_back(e);
-		currentX = nextX;
-		currentY = nextY;
-	}
-	// add the last edge
-	edges.push_back(Edge(QPoint(currentX + center.x(), currentY + center.y()), edges[0].p1));
+	edges = canvas->getEllipse(startX, startY, x, y);
 
 	// put all lines in temp
-	QVector<Temp> result;
-	for (int i = 0; i < edges.size(); ++i)
+	canvas->getOutline(edges, window->getFgColor(), window->isAntialiased(), temp);
+
+	updateTemp(previous);
+}
+
+void Scene::currentBezier(QPointF *points) const
+{
+	points[0] = bezier[0];
+	points[3] = bezier[3];
+	if (bezierPoints == 0)
+	{
+		// straight
+		points[1] = points[0];
+		points[2] = points[3];
+	}
+	else if (bezierPoints == 1)
+	{
+		// quadratic, raise to cubic
+		points[1] = points[0] + (QPointF(bezier[1]) - points[0]) * 2.0 / 3.0;
+		points[2] = points[3] + (QPointF(bezier[1]) - points[3]) * 2.0 / 3.0;
+	}
+	else
 	{
-		getLine(edges[i].p1.x(), edges[i].p1.y(), edges[i].p2.x(), edges[i].p2.y());
-		result.append(temp);
+		points[1] = bezier[1];
+		points[2] = bezier[2];
+	}
+}
+
+void Scene::drawBezier()
+{
+	QVector<Temp> previous;
+	previous.swap(temp);
+
+	QPointF points[4];
+	currentBezier(points);
+	QVector<QPoint> vertices;
+	vertices.push_back(points[0].toPoint());
+	Canvas::flattenBezier(points[0], points[1], points[2], points[3], vertices);
+	if (window->isAntialiased())
+		canvas->getSmoothPolyline(vertices, window->getFgColor(), temp);
+	else
+		canvas->getPolyline(vertices, window->getFgColor(), temp);
+	joinPlaced();
+
+	updateTemp(previous);
+}
+
+void Scene::commitBezier()
+{
+	QPointF points[4];
+	currentBezier(points);
+	QVector<QPoint> vertices;
+	vertices.push_back(points[0].toPoint());
+	Canvas::flattenBezier(points[0], points[1], points[2], points[3], vertices);
+
+	place();
+	for (int i = 1; i < vertices.size(); ++i)
+	{
+		edges.push_back(Edge(vertices[i - 1], vertices[i]));
+	}
+	bezierPending = false;
+}
+
+void Scene::finishBezier()
+{
+	drawingBezier = false;
+	if (edges.isEmpty())
+	{
+		// a click without a segment leaves nothing
+		clearTemp();
+		dropPlaced();
+		return;
 	}
-	temp = result;
 
-	drawTemp();
+	// close the path with a straight edge if it is filled
+	QPoint first = edges.first().p1;
+	QPoint last = edges.last().p2;
+	if (window->getPolyFillType() != MainWindow::NO && first != last)
+	{
+		startX = last.x();
+		startY = last.y();
+		drawLine(first.x(), first.y());
+		edges.push_back(Edge(last, first));
+	}
+	takePlaced();
+	finishShape();
 }
 
 void Scene::clearTemp()
 {
-	// repaint only if start point or end point in canvas
-	if (rect().contains(startX, transformY(startY)) || rect().contains(endX, transformY(endY)))
+	QVector<Temp> previous;
+	previous.swap(temp);
+	updateTemp(previous);
+}
+
+void Scene::updateTemp(const QVector<Temp> &previous)
+{
+	if (generation >= 0xfffffff0u)
 	{
-		clearingTemp = true;
-		repaint(min(startX, endX), transformY(max(startY, endY)), abs(startX - endX) + 1, abs(startY - endY) + 1);
+		stamp.fill(0);
+		generation = 0;
 	}
+	quint32 fresh = ++generation; // in temp, not on screen yet
+	quint32 kept = ++generation; // on screen already, or handled
 
-	temp.clear();
+	for (int i = 0; i < temp.size(); ++i)
+	{
+		if (canvas->contains(temp[i].x, temp[i].y))
+		{
+			int k = temp[i].y * WIDTH + temp[i].x;
+			stamp[k] = fresh;
+			owner[k] = i; // the last one wins, as in done()
+		}
+	}
+
+	// restore pixels that left the outline
+	for (const Temp &t : previous)
+	{
+		if (!canvas->contains(t.x, t.y))
+			continue;
+		int k = t.y * WIDTH + t.x;
+		if (stamp[k] == fresh)
+		{
+			if (temp[owner[k]].color == t.color)
+				stamp[k] = kept;
+		}
+		else if (stamp[k] != kept)
+		{
+			int at = placedAt[k]; // a placed pixel under the rubber band shows again
+			pending.push_back(at >= 0 ? placed[at] : Temp(t.x, t.y, displayColor(t.x, t.y)));
+			stamp[k] = kept;
+		}
+	}
+
+	// draw pixels that joined the outline
+	for (int i = 0; i < temp.size(); ++i)
+	{
+		if (canvas->contains(temp[i].x, temp[i].y))
+		{
+			int k = temp[i].y * WIDTH + temp[i].x;
+			if (stamp[k] == fresh && owner[k] == i)
+				pending.push_back(temp[i]);
+		}
+	}
+
+	repaintPending();
 }
 
-void Scene::drawTemp()
+void Scene::repaintPending()
 {
-	// repaint only if start point or end point in canvas
-	if (rect().contains(startX, transformY(startY)) || rect().contains(endX, transformY(endY)))
+	if (pending.isEmpty())
+		return;
+
+	// merge pending pixels into horizontal or vertical runs
+	QVector<QRect> runs;
+	for (const Temp &t : pending)
+	{
+		int x = t.x;
+		int y = transformY(t.y);
+		if (runs.size())
+		{
+			QRect &r = runs.last();
+			if (r.height() == 1 && r.top() == y && (r.right() + 1 == x || r.left() - 1 == x))
+			{
+				r = r.united(QRect(x, y, 1, 1));
+				continue;
+			}
+			if (r.width() == 1 && r.left() == x && (r.bottom() + 1 == y || r.top() - 1 == y))
+			{
+				r = r.united(QRect(x, y, 1, 1));
+				continue;
+			}
+			if (r.contains(x, y))
+				continue;
+		}
+		runs.push_back(QRect(x, y, 1, 1));
+	}
+
+	// a region of too many rects costs more than its bounding rect
+	QRegion region;
+	if (runs.size() > MAX_RUNS)
+	{
+		QRect bound = runs[0];
+		for (const QRect &r : runs)
+			bound = bound.united(r);
+		region = QRegion(bound);
+	}
+	else
 	{
-		drawingTemp = true;
-		repaint(min(startX, endX) - 1, transformY(max(startY, endY)) - 1, abs(startX - endX) + 3, abs(startY - endY) + 3);
+		for (const QRect &r : runs)
+			region += r;
 	}
+	repaint(region);
 }
 
-void Scene::swapTemp()
+void Scene::repaintSelection()
 {
-	for (int i = 0; i < temp.size(); ++i)
+	QRect bounds = selectionBorder.boundingRect();
+	for (int y = bounds.top(); y <= bounds.bottom(); ++y)
 	{
-		int t = temp[i].x;
-		temp[i].x = temp[i].y;
-		temp[i].y = t;
+		for (int x = selectionBorder.nextSet(y, bounds.left()); x <= bounds.right(); x = selectionBorder.nextSet(y, x + 1))
+			pending.push_back(Temp(x, y, displayColor(x, y)));
 	}
+	repaintPending();
 }
 
-void Scene::flipY(int centerY)
+QColor Scene::displayColor(int x, int y) const
 {
-	for (int i = 0; i < temp.size(); ++i)
+	if (floatingSelection && floatingTarget.contains(x, y))
 	{
-		temp[i].y = 2 * centerY - temp[i].y;
+		if (x == floatingTarget.left() || x == floatingTarget.right() || y == floatingTarget.top() || y == floatingTarget.bottom())
+			return antColor(x, y);
+		QRgb color;
+		floatingLine(y, x, x, &color);
+		return QColor::fromRgba(color);
 	}
+	if (floatingSelection && floatingSource.contains(x, y))
+		return floatingFillColor;
+	if (!selectionBorder.isEmpty() && selectionBorder.test(x, y))
+		return antColor(x, y);
+	return canvas->pixel(x, y);
 }
 
-void Scene::paintEvent(QPaintEvent *e)
+void Scene::compose(const QRect &rect)
 {
-	QPainter cachePainter(cache);
-	QPainter painter(this);
-	if (!clearingTemp && !drawingTemp && !refreshingPermanent) // not need to refresh, use cache
+	QRect refreshRect = refreshingPermanent ? rect.intersected(this->rect()) : QRect();
+	refreshingPermanent = false;
+
+	// pending pixels are inside the region requested by repaintPending
+	QRect dirty = refreshRect;
+	for (const Temp &t : pending)
+		dirty = dirty.united(QRect(t.x, transformY(t.y), 1, 1));
+	if (dirty.isEmpty())
+		return;
+
+	// split dirty region into tiles aligned to TILE_SIZE
+	int firstColumn = dirty.left() / TILE_SIZE;
+	int firstRow = dirty.top() / TILE_SIZE;
+	int columns = dirty.right() / TILE_SIZE - firstColumn + 1;
+	int rows = dirty.bottom() / TILE_SIZE - firstRow + 1;
+	QVector<TileJob> jobs(columns * rows);
+	for (int row = 0; row < rows; ++row)
 	{
-		painter.drawPixmap(e->rect(), *cache, e->rect());
+		for (int column = 0; column < columns; ++column)
+		{
+			QRect tile((firstColumn + column) * TILE_SIZE, (firstRow + row) * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+			jobs[row * columns + column].rect = tile.intersected(dirty);
+		}
+	}
+
+	// hand every pending pixel to the tile containing it
+	for (int i = 0; i < pending.size(); ++i)
+	{
+		int x = pending[i].x;
+		int y = transformY(pending[i].y);
+		jobs[(y / TILE_SIZE - firstRow) * columns + x / TILE_SIZE - firstColumn].temps.push_back(i);
 	}
-	else // refresh canvas and cache
+
+	// skip tiles with nothing to do
+	QVector<TileJob> busy;
+	for (const TileJob &job : jobs)
 	{
-		if (refreshingPermanent)
+		if (job.temps.size() || job.rect.intersects(refreshRect))
+			busy.push_back(job);
+	}
+
+	// bits() may detach, so call it before workers start
+	uchar *bits = cache->bits();
+	int bytesPerLine = cache->bytesPerLine();
+	if (busy.size() == 1)
+	{
+		composeTile(busy[0], bits, bytesPerLine, refreshRect);
+	}
+	else
+	{
+		QtConcurrent::blockingMap(busy, [this, bits, bytesPerLine, refreshRect](const TileJob &job) {
+			composeTile(job, bits, bytesPerLine, refreshRect);
+		});
+	}
+	pending.clear();
+}
+
+void Scene::composeTile(const TileJob &job, uchar *bits, int bytesPerLine, const QRect &refreshRect) const
+{
+	QRect refresh = job.rect.intersected(refreshRect);
+	if (!refresh.isEmpty())
+	{
+		for (int y = refresh.top(); y <= refresh.bottom(); ++y)
 		{
-			refreshingPermanent = false;
-			for (int x = e->rect().left(); x <= e->rect().right(); ++x)
-			{
-				for (int y = e->rect().bottom(); y >= e->rect().top(); --y)
-				{
-					painter.setPen(permanent[transformY(y)][x]);
-					cachePainter.setPen(permanent[transformY(y)][x]);
-					painter.drawPoint(x, y);
-					cachePainter.drawPoint(x, y);
-				}
-			}
+			QRgb *line = reinterpret_cast<QRgb *>(bits + y * bytesPerLine);
+			canvas->readLine(transformY(y), refresh.left(), refresh.right(), line + refresh.left()); // canvas format is converted here, at blit time
 		}
-		if (drawingTemp)
+
+		// floating selection is copied over permanent pixels by rows
+		if (floatingSelection)
 		{
-			drawingTemp = false;
-			for (int i = 0; i < temp.size(); ++i)
+			QRgb fillColor = floatingFillColor.rgb();
+			QRect vacated = refresh.intersected(transformRect(floatingSource));
+			for (int y = vacated.top(); y <= vacated.bottom(); ++y)
+			{
+				QRgb *line = reinterpret_cast<QRgb *>(bits + y * bytesPerLine);
+				std::fill(line + vacated.left(), line + vacated.right() + 1, fillColor);
+			}
+			QRect target = transformRect(floatingTarget);
+			QRect shown = refresh.intersected(target);
+			for (int y = shown.top(); y <= shown.bottom(); ++y)
 			{
-				if (e->rect().contains(temp[i].x, transformY(temp[i].y)))
+				int canvasY = transformY(y);
+				QRgb *line = reinterpret_cast<QRgb *>(bits + y * bytesPerLine);
+				if (y == target.top() || y == target.bottom())
 				{
-					// using temp color
-					painter.setPen(temp[i].color);
-					cachePainter.setPen(temp[i].color);
-					painter.drawPoint(temp[i].x, transformY(temp[i].y));
-					cachePainter.drawPoint(temp[i].x, transformY(temp[i].y));
+					for (int x = shown.left(); x <= shown.right(); ++x)
+						line[x] = antColor(x, canvasY).rgb();
+					continue;
 				}
+				floatingLine(canvasY, shown.left(), shown.right(), line + shown.left());
+				if (shown.left() == target.left())
+					line[target.left()] = antColor(target.left(), canvasY).rgb();
+				if (shown.right() == target.right())
+					line[target.right()] = antColor(target.right(), canvasY).rgb();
 			}
 		}
-		else // clearing temp
+
+		// selection border stays over permanent pixels
+		QRect border = selectionBorder.boundingRect();
+		if (refresh.intersects(QRect(border.left(), transformY(border.bottom()), border.width(), border.height())))
 		{
-			clearingTemp = false;
-			for (int i = 0; i < temp.size(); ++i)
+			for (int y = refresh.top(); y <= refresh.bottom(); ++y)
 			{
-				if (e->rect().contains(temp[i].x, transformY(temp[i].y)))
-				{
-					// using permanent color
-					painter.setPen(permanent[temp[i].y][temp[i].x]);
-					cachePainter.setPen(permanent[temp[i].y][temp[i].x]);
-					painter.drawPoint(temp[i].x, transformY(temp[i].y));
-					cachePainter.drawPoint(temp[i].x, transformY(temp[i].y));
-				}
+				int canvasY = transformY(y);
+				QRgb *line = reinterpret_cast<QRgb *>(bits + y * bytesPerLine);
+				for (int x = selectionBorder.nextSet(canvasY, refresh.left()); x <= refresh.right(); x = selectionBorder.nextSet(canvasY, x + 1))
+					line[x] = displayColor(x, canvasY).rgb();
 			}
 		}
 	}
+	for (int i : job.temps)
+	{
+		const Temp &t = pending[i];
+		QRgb *line = reinterpret_cast<QRgb *>(bits + transformY(t.y) * bytesPerLine);
+		if (t.color.alpha() < 255)
+			line[t.x] = Canvas::blend(t.color.rgba(), displayColor(t.x, t.y).rgba()); // anti-aliased, shown as merge() would blend it
+		else
+			line[t.x] = t.color.rgb();
+	}
+}
+
+void Scene::paintEvent(QPaintEvent *e)
+{
+	if (refreshingPermanent || pending.size())
+		compose(e->rect());
+
+	// the GUI thread only blits finished tiles
+	QPainter painter(this);
+	painter.drawImage(e->rect(), *cache, e->rect());
 }
 
 void Scene::mousePressEvent(QMouseEvent *e)
 {
+	// other tools draw over a committed selection
+	if (floatingSelection && window->getTool() != MainWindow::SELECT)
+		done();
+
+	// switching tools leaves an unfinished polygon or path as the edges placed so far
+	if ((drawingPolygon && window->getTool() != MainWindow::POLYGON) || (drawingBezier && window->getTool() != MainWindow::BEZIER))
+	{
+		drawingPolygon = drawingBezier = bezierPending = false;
+		clearTemp();
+		takePlaced();
+		done();
+	}
+
 	switch (window->getTool())
 	{
 	case MainWindow::PEN:
@@ -587,6 +780,34 @@ void Scene::mousePressEvent(QMouseEvent *e)
 	case MainWindow::FLOOD:
 		floodFill(e->x(), transformY(e->y()));
 		break;
+	case MainWindow::WAND:
+		select(e->x(), transformY(e->y()));
+		break;
+	case MainWindow::SELECT:
+	{
+		int x = e->x();
+		int y = transformY(e->y());
+		if (!floatingSelection && selectionRect.contains(x, y))
+			liftSelection(Canvas::Block());
+		if (floatingSelection && floatingTarget.contains(x, y))
+		{
+			// drag floating pixels
+			draggingSelection = true;
+			startX = x;
+			startY = y;
+			dragOrigin = floatingTarget.topLeft();
+		}
+		else
+		{
+			done();
+			clearSelection();
+			startX = endX = x;
+			startY = endY = y;
+			drawSelectionRect(x, y);
+		}
+		setMouseTracking(true);
+		break;
+	}
 	case MainWindow::ELLIPSE:
 		startX = endX = e->x();
 		startY = endY = transformY(e->y());
@@ -600,7 +821,7 @@ void Scene::mousePressEvent(QMouseEvent *e)
 				// add an edge
 				edges.push_back(Edge(QPoint(startX, startY), QPoint(e->x(), transformY(e->y()))));
 
-				done();
+				place(); // merged with the other edges when the polygon is closed
 				startX = e->x();
 				startY = transformY(e->y());
 			}
@@ -611,32 +832,55 @@ void Scene::mousePressEvent(QMouseEvent *e)
 				clearTemp();
 				// add the last edge
 				drawLine(edges[0].p1.x(), edges[0].p1.y());
-				done();
+				takePlaced();
 				edges.push_back(Edge(QPoint(startX, startY), QPoint(endX, endY)));
-
-				// add shadow
-				switch (window->getPolyFillType())
-				{
-				case MainWindow::SHADOW:
-					fill(window->getShadowInterval());
-					break;
-				case MainWindow::COLOR:
-					fill();
-					break;
-				default:
-					break;
-				}
+				finishShape();
 			}
 		}
 		else // drawingPolygon == false
 		{
 			drawingPolygon = true;
 			edges.clear();
+			dropPlaced();
 			startX = endX = e->x();
 			startY = endY = transformY(e->y());
 			setMouseTracking(true);
 		}
 		break;
+	case MainWindow::BEZIER:
+		if (e->button() == Qt::RightButton)
+		{
+			if (bezierPending)
+				commitBezier();
+			if (drawingBezier)
+				finishBezier();
+		}
+		else if (!bezierPending)
+		{
+			// new segment, starts from the end of the path
+			if (drawingBezier)
+			{
+				bezier[0] = bezier[3];
+			}
+			else
+			{
+				drawingBezier = true;
+				edges.clear();
+				dropPlaced();
+				bezier[0] = QPoint(e->x(), transformY(e->y()));
+			}
+			bezier[3] = QPoint(e->x(), transformY(e->y()));
+			bezierPoints = 0;
+			bezierPending = true;
+			drawBezier();
+		}
+		else if (bezierPoints < 2)
+		{
+			// place next control point
+			bezier[++bezierPoints] = QPoint(e->x(), transformY(e->y()));
+			drawBezier();
+		}
+		break;
 	default:
 		break;
 	}
@@ -664,6 +908,20 @@ void Scene::mouseMoveEvent(QMouseEvent *e)
 	case MainWindow::ELLIPSE:
 		drawRect(e->x(), transformY(e->y()));
 		break;
+	case MainWindow::SELECT:
+		if (draggingSelection)
+			moveFloating(e->x() - startX, transformY(e->y()) - startY);
+		else
+			drawSelectionRect(e->x(), transformY(e->y()));
+		break;
+	case MainWindow::BEZIER:
+		if (bezierPending)
+		{
+			// drag end point first, then control points
+			bezier[bezierPoints == 0 ? 3 : bezierPoints] = QPoint(e->x(), transformY(e->y()));
+			drawBezier();
+		}
+		break;
 	default:
 		break;
 	}
@@ -684,44 +942,117 @@ void Scene::mouseReleaseEvent(QMouseEvent *e)
 	case MainWindow::ELLIPSE:
 		clearTemp();
 		drawEllipse(e->x(), transformY(e->y()));
-		done();
 		setMouseTracking(false);
-		switch (window->getPolyFillType())
-		{
-		case MainWindow::COLOR:
-			fill();
-			break;
-		case MainWindow::SHADOW:
-			fill(window->getShadowInterval());
-			break;
-		default:
-			break;
-		}
+		finishShape();
 		break;
 	case MainWindow::RECT:
-		done();
 		setMouseTracking(false);
 		edges.clear();
 		edges.push_back(Edge(QPoint(startX, startY), QPoint(startX, endY)));
 		edges.push_back(Edge(QPoint(startX, startY), QPoint(endX, startY)));
 		edges.push_back(Edge(QPoint(endX, endY), QPoint(startX, endY)));
 		edges.push_back(Edge(QPoint(endX, endY), QPoint(endX, startY)));
-		switch (window->getPolyFillType())
-		{
-		case MainWindow::SHADOW:
-			fill(window->getShadowInterval());
-			break;
-		case MainWindow::COLOR:
-			fill();
-			break;
-		default:
-			break;
-		}
+		finishShape();
 		break;
 	case MainWindow::POLYGON:
 		break;
+	case MainWindow::BEZIER:
+		if (bezierPending && bezierPoints == 2)
+			commitBezier();
+		break;
+	case MainWindow::SELECT:
+		setMouseTracking(false);
+		if (draggingSelection)
+		{
+			draggingSelection = false; // keep floating until done()
+		}
+		else
+		{
+			clearTemp();
+			if (startX != endX || startY != endY)
+				setSelectionRect(QRect(QPoint(min(startX, endX), min(startY, endY)), QPoint(max(startX, endX), max(startY, endY))));
+		}
+		break;
 	default:
 		setMouseTracking(false);
 		break;
 	}
 }
+
+void Scene::mouseDoubleClickEvent(QMouseEvent *e)
+{
+	if (window->getTool() != MainWindow::BEZIER || e->button() != Qt::LeftButton)
+	{
+		QWidget::mouseDoubleClickEvent(e);
+		return;
+	}
+	// commit the segment as it was before the first click, which placed a point or started a segment
+	if (!bezierPending)
+		return; // the first click placed the second control point, its release committed already
+	if (bezierPoints == 0)
+	{
+		// the first click started an empty segment
+		bezierPending = false;
+		clearTemp();
+		return;
+	}
+	--bezierPoints;
+	drawBezier();
+	commitBezier();
+}
+
+void Scene::keyPressEvent(QKeyEvent *e)
+{
+	if (e->matches(QKeySequence::Copy) || e->matches(QKeySequence::Cut))
+	{
+		// only rect selections can be copied
+		if (floatingSelection)
+			clipboard = floatingSource.isValid() ? canvas->copyRect(floatingSource) : floating;
+		else if (selectionRect.isValid())
+			clipboard = canvas->copyRect(selectionRect);
+		else
+			return;
+		if (e->matches(QKeySequence::Cut))
+			eraseSelection();
+		return;
+	}
+	if (e->matches(QKeySequence::Paste))
+	{
+		if (!clipboard.isEmpty())
+		{
+			done(); // commit current floating selection
+			liftSelection(clipboard);
+		}
+		return;
+	}
+
+	switch (e->key())
+	{
+	case Qt::Key_Escape:
+		if (floatingSelection)
+			dropFloating(true);
+		else
+			clearSelection();
+		break;
+	case Qt::Key_Return:
+	case Qt::Key_Enter:
+		if (bezierPending)
+			commitBezier(); // the path goes on from its end
+		else
+			done();
+		break;
+	case Qt::Key_Delete:
+	case Qt::Key_Backspace:
+		eraseSelection();
+		break;
+	default:
+		QWidget::keyPressEvent(e);
+		break;
+	}
+}
+
+void Scene::timerEvent(QTimerEvent *e)
+{
+	Q_UNUSED(e);
+	journal->checkpoint(canvas); // between operations, so it matches the journal
+}
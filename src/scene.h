@@ -4,8 +4,14 @@
 #include <QWidget>
 #include <QPaintEvent>
 #include <QMouseEvent>
+#include <QKeyEvent>
+#include <QTimerEvent>
 #include "mainwindow.h"
+#include "canvas.h"
+#include "mask.h"
+#include "journal.h"
 #include <QVector>
+#include <QImage>
 
 class Scene : public QWidget
 {
@@ -17,43 +23,51 @@ public:
 private:
 	const int WIDTH = 800;
 	const int HEIGHT = 600;
+	const int TILE_SIZE = 64; // edge length of compositor tiles
+	const int MAX_RUNS = 64; // repaint bounding rect instead of a region with more runs
+	const int CHECKPOINT_INTERVAL = 10000; // ms
 
-	struct Temp // temp pixels
-	{
-		int x;
-		int y;
-		QColor color;
-		Temp(int x = 0, int y = 0, QColor color = QColor()) : x(x), y(y), color(color) {}
-	};
+	typedef Canvas::Temp Temp;
+	typedef Canvas::Edge Edge;
 
-	struct Edge
+	struct TileJob // a piece of the dirty region, composed by one worker
 	{
-		QPoint p1;
-		QPoint p2;
-		QPoint lowerPoint;
-		QPoint upperPoint;
-		Edge(QPoint p1 = QPoint(), QPoint p2 = QPoint()) : p1(p1), p2(p2) {}
-	};
-
-	struct Node
-	{
-		int yMax;
-		double x;
-		double deltaX;
-		int edgeIndex;
-		bool operator<(const Node &ano) const { return (this->x == ano.x) ? (this->deltaX < ano.deltaX) : (this->x < ano.x); }
+		QRect rect;					// widget coordinates, left top is (0, 0)
+		QVector<int> temps; // indexes of pending pixels inside rect
 	};
 
 	MainWindow *window;
 
-	QColor **permanent; // left bottom is (0, 0), all white by default
+	Canvas *canvas;			// permanent pixels, left bottom is (0, 0), all white by default
 	QVector<Temp> temp; // record all temp points. left bottom point is (0, 0)
-	QPixmap *cache;			// left top is (0, 0), to optimize drawing speed
+	QVector<Temp> placed; // polygon edges or bezier segments placed so far, joined and on screen, temp holds only the rubber band
+	QVector<int> placedAt; // index in placed of each canvas pixel, -1 if none
+	QVector<Temp> pending; // pixels to be composed into cache with their color, inside canvas
+	QVector<quint32> stamp; // generation of each pixel, to diff old and new temp
+	QVector<int> owner; // index in temp of each stamped pixel
+	quint32 generation = 0;
+	QImage *cache;			// left top is (0, 0), composed by worker threads, only blitted in paintEvent
+	Journal *journal;		// operations committed to canvas, for restoring after a crash
 
-	bool clearingTemp = false;
-	bool drawingTemp = false;
 	bool refreshingPermanent = false;
 	bool drawingPolygon = false;
+	bool drawingBezier = false; // a bezier path is being drawn
+	bool bezierPending = false; // current segment is not merged to permanent yet
+	int bezierPoints = 0;				// control points placed in current segment, 0 means straight
+	QPoint bezier[4];						// start, control 1, control 2 and end of current segment
+	Mask selection;							// magic wand result, empty if nothing is selected
+	Mask selectionBorder;				// drawn over the canvas as marching ants
+	QRect selectionRect;				// set if selection is a rect, left bottom is (0, 0)
+
+	// floating selection, shown over the canvas until committed in done()
+	bool floatingSelection = false;
+	bool draggingSelection = false;
+	Canvas::Block floating;		// pasted pixels, empty when moving canvas pixels
+	QRect floatingSource;			// vacated canvas rect when moving, empty when pasting
+	QRect floatingTarget;			// where the pixels are shown now
+	QColor floatingFillColor; // of vacated pixels
+	QPoint dragOrigin;				// left bottom of floatingTarget when dragging started
+	Canvas::Block clipboard;
 
 	int startX; // x of start point, left bottom is (0, 0)
 	int startY; // y of start point, left bottom is (0, 0)
@@ -61,31 +75,58 @@ private:
 	int endY;
 	QVector<Edge> edges;
 
-	void BresenhamLine(int x1, int y1, int x2, int y2); // x1 & y1: left bottom point, x2 & y2: right top point
 	void getLine(int x1, int y1, int x2, int y2);				// get line in temp
 	void drawLine(int x, int y);												// with startX and startY, using Bresenham's Algorithm
 	void drawRect(int x, int y);												// with startX/Y
-	void floodFill(int x, int y);												// flood fill 4-connected-region of (x, y) with foreground color
-	void fill(int step = 0);														// according to edges
-	QMap<int, QVector<Node>> constructET();
+	void floodFill(int x, int y);												// flood fill region of (x, y) with foreground color, inside selection if any
+	void select(int x, int y);													// magic wand
+	void clearSelection();
+	void drawSelectionRect(int x, int y);								// rubber band of rect selection, with startX/Y
+	void setSelectionRect(const QRect &rect);
+	void liftSelection(const Canvas::Block &block);			// float pasted pixels, or selected canvas pixels if block is empty
+	void moveFloating(int dx, int dy);									// from dragOrigin
+	void dropFloating(bool keepSource);									// discard floating pixels
+	void floatingLine(int y, int x1, int x2, QRgb *out) const; // floating pixels of canvas row y, x1 <= x2 inside floatingTarget
+	Canvas::FloodRule floodRule() const;								// from window state
+	Canvas::FillStyle fillStyle(const QRect &bounds) const; // from window state, gradients span bounds
+	void fill();																	// according to edges, with fillStyle
+	void finishShape();														// merge temp as the outline of edges, or fill edges with their border
+	void joinPlaced();														// rubber band pixels over placed ones keep the more opaque color
+	void place();																	// move the rubber band in temp to placed, it stays on screen
+	void takePlaced();														// move placed and the rubber band to temp, to be merged or filled
+	void dropPlaced();														// forget placed and restore its pixels on screen
 	void drawEllipse(int x, int y);
+	void currentBezier(QPointF *points) const;	// cubic control points of current segment
+	void drawBezier();	// rubber band of current segment
+	void commitBezier();	// merge current segment to permanent and edges
+	void finishBezier();	// close and fill the path if needed
 
 	int transformY(int y) const { return HEIGHT - y - 1; } // left bottom (0, 0) <-> left top (0, 0)
+	QRect transformRect(const QRect &r) const { return QRect(r.left(), transformY(r.bottom()), r.width(), r.height()); }
 	int max(int a, int b) const { return a > b ? a : b; }
 	int min(int a, int b) const { return a < b ? a : b; }
 	int abs(int a) const { return a > 0 ? a : -a; }
 
-	void clearTemp(); // set temp[] to empty and erase them on canvas according to startX/Y & endX/Y
-	void drawTemp();
-	void swapTemp();										 // temp[].x <-> temp[].y
-	void flipY(int centerY); // temp[].y = 2 * centerY - temp[].y
-	void done();												 // merge temp to permanent
+	void clearTemp(); // set temp[] to empty and erase them on canvas
+	void updateTemp(const QVector<Temp> &previous); // repaint only pixels that differ between previous and temp
+	void repaintPending();
+	void repaintSelection(); // queue border pixels of selection
+	QColor displayColor(int x, int y) const; // permanent pixel, or selection over it
+	QColor antColor(int x, int y) const { return ((x + y) / 4) % 2 ? Qt::white : Qt::black; } // marching ants
+	void eraseSelection(); // fill selection with background color
+	void done();												 // merge temp and floating selection to permanent
+
+	void compose(const QRect &rect); // compose pending pixels, and rect too if refreshingPermanent
+	void composeTile(const TileJob &job, uchar *bits, int bytesPerLine, const QRect &refreshRect) const; // run by worker threads
 
 protected:
 	virtual void paintEvent(QPaintEvent *e);
 	virtual void mousePressEvent(QMouseEvent *e);
 	virtual void mouseMoveEvent(QMouseEvent *e);
 	virtual void mouseReleaseEvent(QMouseEvent *e);
+	virtual void mouseDoubleClickEvent(QMouseEvent *e);
+	virtual void keyPressEvent(QKeyEvent *e);
+	virtual void timerEvent(QTimerEvent *e);
 };
 
 #endif // SCENE_H